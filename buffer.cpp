@@ -1,14 +1,27 @@
 #include "buffer.h"
-#include <fstream>
 #include <iostream>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 using namespace std;
 
-int src_line_no = 1;
-int src_col_no = 0;
-vector<char> buffer;
-size_t current_pos = 0;
+static const size_t stream_block_size = 64 * 1024;
+
+static void buffer_index_lines(source_buffer& b);
 
-int buffer_init(const char* filename)
+#ifdef _WIN32
+static int buffer_open(source_buffer& b, const char* filename)
 {
 	ifstream file(filename, ios::binary);
 	if (!file.is_open())
@@ -16,134 +29,386 @@ int buffer_init(const char* filename)
 		cerr << "Error: File " << filename << " could not be opened" << endl;
 		return -1;
 	}
-	
-	buffer = vector<char>((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
-
-	if (buffer.empty())
+	b.read_buffer = vector<char>((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	file.close();
+	b.window_len = b.read_buffer.size();
+	b.read_buffer.push_back('\0');
+	b.window = b.read_buffer.data();
+	return 0;
+}
+#else
+static int buffer_map_fd(source_buffer& b, int fd, size_t size)
+{
+	// Reserve at least one zeroed byte past the end so the lexer always
+	// finds a '\0' sentinel, even when size is a multiple of the page size.
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t reserve = (size / page + 1) * page;
+	void* base = mmap(nullptr, reserve, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
 	{
-		cerr << "Error: File " << filename << " is empty" << endl;
-		return -2;
+		return -1;
 	}
-
-
-
-	file.close();
+	void* p = mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+	if (p == MAP_FAILED)
+	{
+		munmap(base, reserve);
+		return -1;
+	}
+	madvise(p, size, MADV_SEQUENTIAL);
+	b.mapped_base = base;
+	b.mapped_size = reserve;
+	b.window = static_cast<const char*>(p);
+	b.window_len = size;
 	return 0;
 }
 
-int buffer_get_cur_char(char& c)
+static int buffer_open(source_buffer& b, const char* filename)
 {
-	if (buffer_eof())
+	bool use_stdin = strcmp(filename, "-") == 0;
+	int fd = use_stdin ? STDIN_FILENO : open(filename, O_RDONLY);
+	if (fd < 0)
 	{
-		c = '\0';
+		cerr << "Error: File " << filename << " could not be opened" << endl;
 		return -1;
 	}
-	c = buffer[current_pos];
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && buffer_map_fd(b, fd, (size_t)st.st_size) == 0)
+	{
+		if (!use_stdin)
+		{
+			close(fd);
+		}
+		return 0;
+	}
+
+	b.stream_fd = fd;
+	b.stream_done = false;
+	b.read_buffer.resize(2 * stream_block_size + 1);
+	b.window = b.read_buffer.data();
+	buffer_refill(b, 0);
 	return 0;
 }
+#endif
 
-int buffer_next_char(void)
+int buffer_refill(source_buffer& b, size_t keep_from)
 {
-	if (buffer_eof())
+#ifdef _WIN32
+	return -1;
+#else
+	if (b.stream_done)
 	{
 		return -1;
 	}
-	char c = buffer[current_pos];
-	if (c == '\n')
+	buffer_index_lines(b);
+
+	size_t window_end = b.window_base + b.window_len;
+	size_t history_start = window_end > stream_block_size ? window_end - stream_block_size : 0;
+	size_t new_base = max(b.window_base, min(keep_from, history_start));
+	size_t kept = window_end - new_base;
+
+	if (kept + stream_block_size + 1 > b.read_buffer.size())
 	{
-		src_line_no++;
-		src_col_no = 1;
+		b.read_buffer.resize(kept + stream_block_size + 1);
 	}
-	else
+	memmove(b.read_buffer.data(), b.read_buffer.data() + (new_base - b.window_base), kept);
+	b.window = b.read_buffer.data();
+	b.window_base = new_base;
+	b.window_len = kept;
+
+	auto keep = upper_bound(b.line_starts.begin(), b.line_starts.end(), b.window_base);
+	if (keep - b.line_starts.begin() > 1)
 	{
-		src_col_no++;
+		size_t dropped = keep - 1 - b.line_starts.begin();
+		b.line_starts.erase(b.line_starts.begin(), keep - 1);
+		b.line_first += dropped;
 	}
-	current_pos++;
+	b.line_hint = 0;
+
+	ssize_t n;
+	do
+	{
+		n = read(b.stream_fd, b.read_buffer.data() + kept, stream_block_size);
+	} while (n < 0 && errno == EINTR);
+
+	if (n <= 0)
+	{
+		if (n < 0)
+		{
+			cerr << "Error: Source stream could not be read" << endl;
+		}
+		b.stream_done = true;
+		b.read_buffer[kept] = '\0';
+		return -1;
+	}
+	b.window_len += n;
+	b.read_buffer[b.window_len] = '\0';
 	return 0;
+#endif
 }
 
-int buffer_get_next_char(char& c)
+static bool buffer_available(source_buffer& b)
 {
-	if (buffer_eof())
+	if (b.current_pos < b.window_base + b.window_len)
+	{
+		return true;
+	}
+	return buffer_refill(b, b.current_pos > 0 ? b.current_pos - 1 : 0) == 0 && b.current_pos < b.window_base + b.window_len;
+}
+
+int buffer_init(source_buffer& b, const char* filename)
+{
+	buffer_cleanup(b);
+
+	if (buffer_open(b, filename) != 0)
 	{
-		c = '\0';
 		return -1;
 	}
-	c = buffer[current_pos];
-	return buffer_next_char();
+
+	if (b.window_len == 0)
+	{
+		cerr << "Error: File " << filename << " is empty" << endl;
+		return -2;
+	}
+
+	return 0;
 }
 
+// Reads from text[0, len) in memory. The caller keeps the text alive and
+// puts a '\0' at text[len] for the lexer, as std::string does.
+int buffer_init_text(source_buffer& b, const char* text, size_t len)
+{
+	buffer_cleanup(b);
+	b.window = text;
+	b.window_len = len;
+	return 0;
+}
 
-bool buffer_eof(void)
+int buffer_get_cur_char(source_buffer& b, char& c)
 {
-	return current_pos >= buffer.size();
+	if (buffer_eof(b))
+	{
+		c = '\0';
+		return -1;
+	}
+	c = b.window[b.current_pos - b.window_base];
+	return 0;
 }
 
-int buffer_back_char(void)
+int buffer_next_char(source_buffer& b)
 {
-	if (current_pos == 0)
+	if (buffer_eof(b))
 	{
 		return -1;
 	}
-	current_pos--;
-	char c = buffer[current_pos];
-	if (c == '\n')
+	b.current_pos++;
+	return 0;
+}
+
+int buffer_get_next_char(source_buffer& b, char& c)
+{
+	if (buffer_eof(b))
 	{
-		src_line_no--;
-		src_col_no = 1;
+		c = '\0';
+		return -1;
 	}
-	else
+	c = b.window[b.current_pos - b.window_base];
+	return buffer_next_char(b);
+}
+
+
+bool buffer_eof(source_buffer& b)
+{
+	return !buffer_available(b);
+}
+
+int buffer_back_char(source_buffer& b)
+{
+	if (b.current_pos <= b.window_base)
 	{
-		src_col_no--;
+		return -1;
 	}
+	b.current_pos--;
 	return 0;
 }
 
-int buffer_peek_next_char(char& c)
+int buffer_peek_next_char(source_buffer& b, char& c)
 {
-	if (current_pos >= buffer.size())
+	if (!buffer_available(b))
 	{
 		c = '\0';
 		return -1;
 	}
-	c = buffer[current_pos];
+	c = b.window[b.current_pos - b.window_base];
 	return 0;
 }
 
-int buffer_cleanup(void)
+int buffer_cleanup(source_buffer& b)
 {
-	buffer.clear();
+#ifndef _WIN32
+	if (b.mapped_base != nullptr)
+	{
+		munmap(b.mapped_base, b.mapped_size);
+		b.mapped_base = nullptr;
+		b.mapped_size = 0;
+	}
+	if (b.stream_fd > STDIN_FILENO)
+	{
+		close(b.stream_fd);
+	}
+#endif
+	b.stream_fd = -1;
+	b.stream_done = true;
+	b.read_buffer.clear();
+	b.read_buffer.shrink_to_fit();
+	b.window = nullptr;
+	b.window_base = 0;
+	b.window_len = 0;
+	b.current_pos = 0;
+	b.line_starts.clear();
+	b.line_starts.shrink_to_fit();
+	b.line_first = 0;
+	b.line_scanned = 0;
+	b.line_hint = 0;
 	return 0;
 }
 
-int get_src_line(int line_no, string& line)
+size_t buffer_pos(const source_buffer& b)
+{
+	return b.current_pos;
+}
+
+void buffer_seek(source_buffer& b, size_t pos)
+{
+	b.current_pos = pos;
+}
+
+const char* buffer_at(const source_buffer& b, size_t pos)
+{
+	return b.window + (pos - b.window_base);
+}
+
+size_t buffer_end(const source_buffer& b)
 {
-	int start_pos = -1;
-	int end_pos = -1;
-	int current_line = 1;
+	return b.window_base + b.window_len;
+}
 
-	for (int i = 0; i < buffer.size(); i++)
+bool buffer_streaming(const source_buffer& b)
+{
+	return b.stream_fd >= 0;
+}
+
+static void buffer_index_lines(source_buffer& b)
+{
+	if (b.line_starts.empty() && b.line_first == 0)
 	{
-		if (current_line == line_no && start_pos == -1)
+		b.line_starts.push_back(0);
+	}
+
+	size_t end = b.window_base + b.window_len;
+	size_t i = max(b.line_scanned, b.window_base);
+#ifdef __SSE2__
+	const __m128i newline = _mm_set1_epi8('\n');
+	for (; i + 16 <= end; i += 16)
+	{
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b.window + (i - b.window_base)));
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+		while (mask != 0)
 		{
-			start_pos = i;
+			b.line_starts.push_back(i + __builtin_ctz(mask) + 1);
+			mask &= mask - 1;
 		}
-		if (current_line == line_no && (buffer[i] == '\n' || i == buffer.size() - 1))
+	}
+#endif
+	for (; i < end; i++)
+	{
+		if (b.window[i - b.window_base] == '\n')
 		{
-			end_pos = i;
-			break;
+			b.line_starts.push_back(i + 1);
 		}
-		if (buffer[i] == '\n')
+	}
+
+	b.line_scanned = end;
+}
+
+// Lines must be indexed up to offset. hint is the line of the previous
+// lookup, so walking forward through a source stays linear.
+static long long buffer_line_find(const source_buffer& b, size_t offset, size_t& hint)
+{
+	if (b.line_starts.empty() || offset < b.line_starts[0])
+	{
+		return -1;
+	}
+
+	size_t count = b.line_starts.size();
+	if (hint < count && b.line_starts[hint] <= offset)
+	{
+		if (hint + 1 == count || offset < b.line_starts[hint + 1])
 		{
-			current_line++;
+			return b.line_first + hint;
+		}
+		if (hint + 2 == count || offset < b.line_starts[hint + 2])
+		{
+			return b.line_first + ++hint;
 		}
 	}
 
-	if (start_pos == -1 || end_pos == -1)
+	hint = (upper_bound(b.line_starts.begin(), b.line_starts.end(), offset) - b.line_starts.begin()) - 1;
+	return b.line_first + hint;
+}
+
+static int buffer_line_col_at(const source_buffer& b, size_t offset, long long index, int& line, int& col)
+{
+	if (offset > b.window_base + b.window_len || index < 0)
+	{
+		line = 0;
+		col = 0;
+		return -1;
+	}
+	line = (int)index + 1;
+	col = (int)(offset - b.line_starts[index - b.line_first]) + 1;
+	return 0;
+}
+
+int buffer_line_col(source_buffer& b, size_t offset, int& line, int& col)
+{
+	if (b.line_scanned < b.window_base + b.window_len || b.line_starts.empty())
+	{
+		buffer_index_lines(b);
+	}
+	return buffer_line_col_at(b, offset, buffer_line_find(b, offset, b.line_hint), line, col);
+}
+
+// Never indexes, so several threads can share b once a non-const call has
+// indexed the window; each keeps its own hint.
+int buffer_line_col(const source_buffer& b, size_t offset, int& line, int& col, size_t& hint)
+{
+	return buffer_line_col_at(b, offset, buffer_line_find(b, offset, hint), line, col);
+}
+
+int get_src_line(source_buffer& b, int line_no, string& line)
+{
+	if (b.line_scanned < b.window_base + b.window_len || b.line_starts.empty())
+	{
+		buffer_index_lines(b);
+	}
+	if (line_no < 1 || (size_t)line_no <= b.line_first || (size_t)line_no > b.line_first + b.line_starts.size())
+	{
+		return -2;
+	}
+
+	size_t local = line_no - 1 - b.line_first;
+	size_t start_pos = b.line_starts[local];
+	size_t end_pos = local + 1 < b.line_starts.size() ? b.line_starts[local + 1] - 1 : b.window_base + b.window_len;
+	if (start_pos < b.window_base)
 	{
 		return -2;
 	}
+	if (end_pos > start_pos && b.window[end_pos - 1 - b.window_base] == '\r')
+	{
+		end_pos--;
+	}
 
-	line.assign(buffer.begin() + start_pos, buffer.begin() + end_pos);
+	line.assign(b.window + (start_pos - b.window_base), b.window + (end_pos - b.window_base));
 	return 0;
 }
@@ -6,26 +6,62 @@
 using std::string;
 using namespace std;
 
-extern int src_line_no;
-extern int src_col_no;
-extern vector<char> buffer;
+// One source file or stream. Bytes [window_base, window_base + window_len)
+// of the source are resident at window. A mapped file is a single window;
+// a stream slides it forward. line_starts indexes the lines seen so far.
+struct source_buffer
+{
+	const char* window = nullptr;
+	size_t window_base = 0;
+	size_t window_len = 0;
+	size_t current_pos = 0;
 
-int buffer_init(const char* filename);
+	void* mapped_base = nullptr;
+	size_t mapped_size = 0;
+	vector<char> read_buffer;
+	int stream_fd = -1;
+	bool stream_done = true;
 
-int buffer_get_cur_char(char& c);
+	vector<size_t> line_starts;
+	size_t line_first = 0;
+	size_t line_scanned = 0;
+	size_t line_hint = 0;
+};
 
-int buffer_next_char(void);
+int buffer_init(source_buffer& b, const char* filename);
 
-int buffer_get_next_char(char& c);
+int buffer_init_text(source_buffer& b, const char* text, size_t len);
 
-bool buffer_eof(void);
+int buffer_get_cur_char(source_buffer& b, char& c);
 
-int buffer_back_char(void);
+int buffer_next_char(source_buffer& b);
 
-int buffer_peek_next_char(char& c);
+int buffer_get_next_char(source_buffer& b, char& c);
 
-int buffer_cleanup(void);
+bool buffer_eof(source_buffer& b);
 
-int get_src_line(int line_no, string& line);
+int buffer_back_char(source_buffer& b);
+
+int buffer_peek_next_char(source_buffer& b, char& c);
+
+int buffer_cleanup(source_buffer& b);
+
+size_t buffer_pos(const source_buffer& b);
+
+void buffer_seek(source_buffer& b, size_t pos);
+
+const char* buffer_at(const source_buffer& b, size_t pos);
+
+size_t buffer_end(const source_buffer& b);
+
+int buffer_refill(source_buffer& b, size_t keep_from);
+
+bool buffer_streaming(const source_buffer& b);
+
+int buffer_line_col(source_buffer& b, size_t offset, int& line, int& col);
+
+int buffer_line_col(const source_buffer& b, size_t offset, int& line, int& col, size_t& hint);
+
+int get_src_line(source_buffer& b, int line_no, string& line);
 
 #endif
\ No newline at end of file
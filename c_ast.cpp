@@ -0,0 +1,141 @@
+#include "c_ast.h"
+#include "c_walk.h"
+
+static void remember(vector<string_view>& table, int index, string_view text)
+{
+	if (index < 0)
+	{
+		return;
+	}
+	if ((size_t)index >= table.size())
+	{
+		table.resize(index + 1);
+	}
+	table[index] = text;
+}
+
+void compact_ast::build(const vector<node*>& program_statements)
+{
+	nodes.clear();
+	statements.clear();
+	names.clear();
+	strings.clear();
+
+	// Nodes are laid out in pre-order, so a walk mostly moves forward
+	// through memory. Each pending entry says which link of which node the
+	// converted subtree goes into.
+	enum link_kind { link_left, link_right, link_next };
+	struct pending
+	{
+		const node* source;
+		uint32_t parent;
+		link_kind link;
+	};
+	vector<pending> stack;
+
+	for (const node* root : program_statements)
+	{
+		statements.push_back((uint32_t)nodes.size());
+		stack.push_back({ root, ast_none, link_left });
+		while (!stack.empty())
+		{
+			pending top = stack.back();
+			stack.pop_back();
+			const node* n = top.source;
+
+			uint32_t id = (uint32_t)nodes.size();
+			if (top.parent != ast_none)
+			{
+				ast_node& p = nodes[top.parent];
+				(top.link == link_left ? p.left : top.link == link_right ? p.right : p.next) = id;
+			}
+
+			ast_node a;
+			a.op = (uint8_t)n->token.id;
+			a.val_type = (uint8_t)n->val_type;
+			a.line = (uint32_t)min(max(n->token.line, 0), (int)ast_max_line);
+			a.left = ast_none;
+			a.right = ast_none;
+			a.next = ast_none;
+			a.operand = 0;
+
+			switch (n->token.id)
+			{
+			case TOKEN_INTEGER:
+				a.operand = n->value;
+				break;
+			case TOKEN_STRING:
+				a.operand = n->value;
+				remember(strings, n->value, n->token.val);
+				break;
+			case TOKEN_IDENT:
+				a.operand = n->symbol_table_index;
+				remember(names, n->symbol_table_index, n->token.val);
+				break;
+			default:
+				break;
+			}
+			nodes.push_back(a);
+
+			if (n->next != nullptr)
+			{
+				stack.push_back({ n->next, id, link_next });
+			}
+			if (n->right != nullptr)
+			{
+				stack.push_back({ n->right, id, link_right });
+			}
+			if (n->left != nullptr)
+			{
+				stack.push_back({ n->left, id, link_left });
+			}
+		}
+	}
+	node_data = nodes.data();
+	node_count = nodes.size();
+}
+
+string_view compact_ast::text(uint32_t n) const
+{
+	const ast_node& a = node_data[n];
+	const vector<string_view>* table = a.op == TOKEN_IDENT ? &names : a.op == TOKEN_STRING ? &strings : nullptr;
+	if (table == nullptr || a.operand < 0 || (size_t)a.operand >= table->size())
+	{
+		return string_view();
+	}
+	return (*table)[a.operand];
+}
+
+size_t compact_ast::bytes() const
+{
+	return node_count * sizeof(ast_node) + statements.size() * sizeof(uint32_t)
+		+ (names.size() + strings.size()) * sizeof(string_view);
+}
+
+int compact_ast::evaluate_statement_list(compilation_context& ctx, uint32_t head) const
+{
+	if (ctx.verified)
+	{
+		return walk_evaluate_list<compact_view, false>(compact_view{ *this }, ctx, head);
+	}
+	return walk_evaluate_list(compact_view{ *this }, ctx, head);
+}
+
+int compact_ast::evaluate(compilation_context& ctx, uint32_t n) const
+{
+	if (ctx.verified)
+	{
+		return walk_evaluate<compact_view, false>(compact_view{ *this }, ctx, n);
+	}
+	return walk_evaluate(compact_view{ *this }, ctx, n);
+}
+
+bool verify_program(compilation_context& ctx, const compact_ast& ast)
+{
+	return walk_verify_program(compact_view{ ast }, ctx, ast.statements);
+}
+
+void print_tree(const compact_ast& ast, uint32_t root, int space)
+{
+	walk_print(compact_view{ ast }, root, space);
+}
@@ -0,0 +1,60 @@
+#ifndef C_AST_H
+#define C_AST_H
+
+#include "c_tree.h"
+#include "context.h"
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+// A parsed program flattened into one vector. Children are 32-bit indices
+// into the same vector and ast_none marks a missing one. op is the token
+// id. operand holds what the walks need from the token: the value of an
+// integer literal, the symbol index of a variable or the string_table id of
+// a string literal. op, val_type and line share one word; line saturates at
+// ast_max_line. No text is kept per node: a variable's name and a string
+// literal's text are found through operand, and nothing else needs one.
+static const uint32_t ast_none = UINT32_MAX;
+static const uint32_t ast_max_line = 0xFFFFFF;
+
+struct ast_node
+{
+	uint32_t op : 6;
+	uint32_t val_type : 2;
+	uint32_t line : 24;
+	uint32_t left;
+	uint32_t right;
+	uint32_t next;
+	int32_t operand;
+};
+
+static_assert(TOKEN_FALSE < 64 && vt_bool < 4, "ast_node op and val_type are too narrow");
+
+class compact_ast
+{
+public:
+	vector<ast_node> nodes;
+	vector<uint32_t> statements;
+
+	// Variable names by symbol index and string literals by string_table id.
+	vector<string_view> names;
+	vector<string_view> strings;
+
+	// The nodes the walks read: nodes.data() after build, or the node array
+	// of a mapped cache file (see ast_cache_load).
+	ast_node* node_data = nullptr;
+	size_t node_count = 0;
+
+	void build(const vector<node*>& program_statements);
+	string_view text(uint32_t n) const;
+	int evaluate(compilation_context& ctx, uint32_t n) const;
+	int evaluate_statement_list(compilation_context& ctx, uint32_t head) const;
+	size_t bytes() const;
+};
+
+void print_tree(const compact_ast& ast, uint32_t root, int space = 0);
+bool verify_program(compilation_context& ctx, const compact_ast& ast);
+
+#endif
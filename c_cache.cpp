@@ -0,0 +1,345 @@
+#include "c_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const char ast_cache_magic[4] = { 'N', 'C', 'C', 'A' };
+static const uint32_t ast_cache_version = 3;
+
+// The sections follow the header in this order, each on an 8-byte
+// boundary: nodes, statements, strings, symbols and the blob the strings and
+// symbol names point into.
+struct cache_header
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t node_size;
+	uint32_t node_count;
+	uint64_t source_hash;
+	uint64_t source_size;
+	uint32_t statement_count;
+	uint32_t string_count;
+	uint32_t symbol_count;
+	uint32_t unused;
+	uint64_t blob_size;
+};
+
+struct cache_text
+{
+	uint32_t offset;
+	uint32_t length;
+};
+
+struct cache_symbol
+{
+	cache_text name;
+	uint8_t sym_type;
+	uint8_t loc_type;
+	uint8_t val_type;
+	uint8_t unused;
+	int32_t offset;
+};
+
+struct cache_layout
+{
+	size_t nodes;
+	size_t statements;
+	size_t strings;
+	size_t symbols;
+	size_t blob;
+	size_t end;
+};
+
+static size_t align8(size_t n)
+{
+	return (n + 7) & ~(size_t)7;
+}
+
+static cache_layout layout_of(const cache_header& h)
+{
+	cache_layout l;
+	l.nodes = align8(sizeof(cache_header));
+	l.statements = align8(l.nodes + (size_t)h.node_count * sizeof(ast_node));
+	l.strings = align8(l.statements + (size_t)h.statement_count * sizeof(uint32_t));
+	l.symbols = align8(l.strings + (size_t)h.string_count * sizeof(cache_text));
+	l.blob = align8(l.symbols + (size_t)h.symbol_count * sizeof(cache_symbol));
+	l.end = l.blob + h.blob_size;
+	return l;
+}
+
+static inline uint64_t hash_step(uint64_t h, uint64_t w)
+{
+	h ^= w * 0x87C37B91114253D5ull;
+	h = (h << 31) | (h >> 33);
+	return h * 0x4CF5AD432745937Full;
+}
+
+// Not cryptographic; it only has to tell one version of a source from the
+// next. Eight bytes a step, so hashing stays well below the cost of lexing.
+uint64_t ast_source_hash(const char* data, size_t len)
+{
+	uint64_t h = hash_step(0, len);
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		uint64_t w;
+		memcpy(&w, data + i, 8);
+		h = hash_step(h, w);
+	}
+	uint64_t tail = 0;
+	memcpy(&tail, data + i, len - i);
+	h = hash_step(h, tail);
+
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+#ifdef _WIN32
+static bool cache_open(ast_cache& cache, const string& path)
+{
+	ifstream file(path, ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	cache.read_buffer = vector<char>((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	return true;
+}
+#else
+static bool cache_open(ast_cache& cache, const string& path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat st;
+	void* p = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+		// Writable but private: optimize rewrites nodes in place, which
+		// copies only the pages it touches and never reaches the file.
+		p = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (p == MAP_FAILED)
+	{
+		return false;
+	}
+	cache.mapped_base = p;
+	cache.mapped_size = (size_t)st.st_size;
+	return true;
+}
+#endif
+
+void ast_cache_close(ast_cache& cache)
+{
+#ifndef _WIN32
+	if (cache.mapped_base != nullptr)
+	{
+		munmap(cache.mapped_base, cache.mapped_size);
+	}
+#endif
+	cache.mapped_base = nullptr;
+	cache.mapped_size = 0;
+	cache.read_buffer.clear();
+}
+
+static bool text_fits(const cache_text& t, uint64_t blob_size)
+{
+	return (uint64_t)t.offset + t.length <= blob_size;
+}
+
+// Only the shape is checked: section sizes, text bounds, that every index
+// stays inside its table and that the nodes form a forest. build lays
+// nodes out in pre-order, so every link must point forward and no node may
+// be reached twice; a damaged file then can neither send a walk out of
+// bounds nor into a cycle. Nothing is re-derived from the source.
+static bool cache_valid(const cache_header& h, const char* base)
+{
+	cache_layout l = layout_of(h);
+	const ast_node* nodes = reinterpret_cast<const ast_node*>(base + l.nodes);
+	const uint32_t* statements = reinterpret_cast<const uint32_t*>(base + l.statements);
+	const cache_text* strings = reinterpret_cast<const cache_text*>(base + l.strings);
+	const cache_symbol* symbols = reinterpret_cast<const cache_symbol*>(base + l.symbols);
+
+	for (uint32_t i = 0; i < h.string_count; i++)
+	{
+		if (!text_fits(strings[i], h.blob_size))
+		{
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < h.symbol_count; i++)
+	{
+		if (!text_fits(symbols[i].name, h.blob_size))
+		{
+			return false;
+		}
+	}
+	vector<bool> reached(h.node_count, false);
+	auto reach = [&](uint32_t child, uint32_t after)
+	{
+		if (child == ast_none)
+		{
+			return true;
+		}
+		if (child >= h.node_count || (after != ast_none && child <= after) || reached[child])
+		{
+			return false;
+		}
+		reached[child] = true;
+		return true;
+	};
+	for (uint32_t i = 0; i < h.statement_count; i++)
+	{
+		if (statements[i] == ast_none || !reach(statements[i], ast_none))
+		{
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < h.node_count; i++)
+	{
+		const ast_node& n = nodes[i];
+		if (!reach(n.left, i) || !reach(n.right, i) || !reach(n.next, i))
+		{
+			return false;
+		}
+		if ((n.op == TOKEN_IDENT && (n.operand < 0 || (uint32_t)n.operand >= h.symbol_count))
+			|| (n.op == TOKEN_STRING && (n.operand < 0 || (uint32_t)n.operand >= h.string_count)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ast_cache_load(ast_cache& cache, const string& path, uint64_t hash, size_t source_size, compilation_context& ctx, compact_ast& ast)
+{
+	if (!cache_open(cache, path))
+	{
+		return false;
+	}
+	const char* base = cache.mapped_base != nullptr ? static_cast<const char*>(cache.mapped_base) : cache.read_buffer.data();
+	size_t size = cache.mapped_base != nullptr ? cache.mapped_size : cache.read_buffer.size();
+
+	cache_header h;
+	if (size < sizeof(h))
+	{
+		ast_cache_close(cache);
+		return false;
+	}
+	memcpy(&h, base, sizeof(h));
+	if (memcmp(h.magic, ast_cache_magic, sizeof(h.magic)) != 0 || h.version != ast_cache_version || h.node_size != sizeof(ast_node)
+		|| h.source_hash != hash || h.source_size != source_size || layout_of(h).end != size || !cache_valid(h, base))
+	{
+		ast_cache_close(cache);
+		return false;
+	}
+
+	cache_layout l = layout_of(h);
+	const uint32_t* statements = reinterpret_cast<const uint32_t*>(base + l.statements);
+	const cache_text* strings = reinterpret_cast<const cache_text*>(base + l.strings);
+	const cache_symbol* symbols = reinterpret_cast<const cache_symbol*>(base + l.symbols);
+	const char* blob = base + l.blob;
+
+	ast.nodes.clear();
+	ast.node_data = reinterpret_cast<ast_node*>(const_cast<char*>(base) + l.nodes);
+	ast.node_count = h.node_count;
+	ast.statements.assign(statements, statements + h.statement_count);
+	ast.strings.resize(h.string_count);
+	ast.names.resize(h.symbol_count);
+
+	ctx.string_table.clear();
+	for (uint32_t i = 0; i < h.string_count; i++)
+	{
+		ast.strings[i] = string_view(blob + strings[i].offset, strings[i].length);
+		ctx.string_table.emplace_back(ast.strings[i]);
+	}
+	ctx.sym_table.clear();
+	for (uint32_t i = 0; i < h.symbol_count; i++)
+	{
+		const cache_symbol& s = symbols[i];
+		ast.names[i] = string_view(blob + s.name.offset, s.name.length);
+		ctx.sym_table.push_back({ string(blob + s.name.offset, s.name.length), (symbol_type)s.sym_type,
+			(location_type)s.loc_type, (value_type)s.val_type, s.offset });
+	}
+	return true;
+}
+
+bool ast_cache_save(const string& path, uint64_t hash, size_t source_size, const compilation_context& ctx, const compact_ast& ast)
+{
+	string blob;
+	auto store = [&](string_view text)
+	{
+		cache_text t = { (uint32_t)blob.size(), (uint32_t)text.size() };
+		blob.append(text.data(), text.size());
+		return t;
+	};
+
+	vector<cache_text> strings;
+	for (const string& s : ctx.string_table)
+	{
+		strings.push_back(store(s));
+	}
+	vector<cache_symbol> symbols;
+	for (const symbol_data& s : ctx.sym_table)
+	{
+		symbols.push_back({ store(s.name), (uint8_t)s.sym_type, (uint8_t)s.loc_type, (uint8_t)s.val_type, 0, s.offset });
+	}
+	if (blob.size() > UINT32_MAX || ast.node_count > UINT32_MAX)
+	{
+		return false;
+	}
+
+	cache_header h = {};
+	memcpy(h.magic, ast_cache_magic, sizeof(h.magic));
+	h.version = ast_cache_version;
+	h.node_size = sizeof(ast_node);
+	h.node_count = (uint32_t)ast.node_count;
+	h.source_hash = hash;
+	h.source_size = source_size;
+	h.statement_count = (uint32_t)ast.statements.size();
+	h.string_count = (uint32_t)strings.size();
+	h.symbol_count = (uint32_t)symbols.size();
+	h.blob_size = blob.size();
+	cache_layout l = layout_of(h);
+
+	// Written beside the target and renamed over it, so a concurrent run
+	// maps either the old file or the complete new one.
+	string temp = path + ".tmp";
+	ofstream out(temp, ios::binary | ios::trunc);
+	size_t written = 0;
+	auto put = [&](size_t at, const void* data, size_t bytes)
+	{
+		static const char padding[8] = {};
+		out.write(padding, at - written);
+		out.write(static_cast<const char*>(data), bytes);
+		written = at + bytes;
+	};
+	put(0, &h, sizeof(h));
+	put(l.nodes, ast.node_data, ast.node_count * sizeof(ast_node));
+	put(l.statements, ast.statements.data(), ast.statements.size() * sizeof(uint32_t));
+	put(l.strings, strings.data(), strings.size() * sizeof(cache_text));
+	put(l.symbols, symbols.data(), symbols.size() * sizeof(cache_symbol));
+	put(l.blob, blob.data(), blob.size());
+	out.close();
+	if (!out || rename(temp.c_str(), path.c_str()) != 0)
+	{
+		remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,33 @@
+#ifndef C_CACHE_H
+#define C_CACHE_H
+
+#include "c_ast.h"
+#include "context.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+using namespace std;
+
+// A compact_ast saved together with the sym_table and string_table it
+// refers to, so an unchanged source runs without being lexed or parsed.
+// The file is mapped and its node array used in place; only the strings
+// and names are fixed up into string_views. A file from another version,
+// with another node layout or for another source is simply a miss.
+struct ast_cache
+{
+	void* mapped_base = nullptr;
+	size_t mapped_size = 0;
+	vector<char> read_buffer;
+};
+
+uint64_t ast_source_hash(const char* data, size_t len);
+
+// On success ast points into cache, which must stay open while ast is used.
+bool ast_cache_load(ast_cache& cache, const string& path, uint64_t hash, size_t source_size, compilation_context& ctx, compact_ast& ast);
+
+bool ast_cache_save(const string& path, uint64_t hash, size_t source_size, const compilation_context& ctx, const compact_ast& ast);
+
+void ast_cache_close(ast_cache& cache);
+
+#endif
@@ -0,0 +1,431 @@
+#include "c_closure.h"
+#include "c_walk.h"
+
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+
+// Lets walk_evaluate_deep run closures the way it runs either AST.
+struct closure_view
+{
+	typedef const closure* ref;
+
+	ref none() const { return nullptr; }
+	token_id op(ref c) const { return c->op; }
+	ref left(ref c) const { return c->left; }
+	ref right(ref c) const { return c->right; }
+	ref next(ref c) const { return c->next; }
+	int line(ref c) const { return c->line; }
+	value_type type(ref c) const { return c->type; }
+	int integer(ref c) const { return c->value; }
+	int symbol(ref c) const { return c->value; }
+	string_view text(ref c) const { return c->text; }
+	string_view string_value(const compilation_context&, ref c) const { return c->text; }
+};
+
+static inline int eval(const closure* c, closure_state& s)
+{
+	return c->run(c, s);
+}
+
+static int run_deep(const closure* c, closure_state& s)
+{
+	return walk_evaluate_deep(closure_view(), s.ctx, c, false);
+}
+
+static int run_constant(const closure* c, closure_state&)
+{
+	return c->value;
+}
+
+static int run_zero(const closure*, closure_state&)
+{
+	return 0;
+}
+
+static int run_load(const closure* c, closure_state& s)
+{
+	return s.vars[c->value];
+}
+
+static int run_negate(const closure* c, closure_state& s)
+{
+	return -eval(c->right, s);
+}
+
+#define CLOSURE_BINARY(name, result) \
+	static int run_##name(const closure* c, closure_state& s) { int l = eval(c->left, s); int r = eval(c->right, s); return (result); } \
+	static int run_##name##_k(const closure* c, closure_state& s) { int l = eval(c->left, s); int r = c->value; return (result); } \
+	static int run_##name##_v(const closure* c, closure_state& s) { int l = eval(c->left, s); int r = s.vars[c->value]; return (result); }
+
+CLOSURE_BINARY(add, l + r)
+CLOSURE_BINARY(sub, l - r)
+CLOSURE_BINARY(mul, l * r)
+CLOSURE_BINARY(less, l < r ? 1 : 0)
+CLOSURE_BINARY(less_eq, l <= r ? 1 : 0)
+CLOSURE_BINARY(greater, l > r ? 1 : 0)
+CLOSURE_BINARY(greater_eq, l >= r ? 1 : 0)
+CLOSURE_BINARY(equal, l == r ? 1 : 0)
+CLOSURE_BINARY(not_equal, l != r ? 1 : 0)
+
+// The divisor is checked before the dividend is evaluated.
+static int run_div(const closure* c, closure_state& s)
+{
+	int r = eval(c->right, s);
+	if (r == 0)
+	{
+		output_flush(s.ctx.output);
+		cerr << "Runtime Error: " << (c->op == TOKEN_DIV ? "Division" : "Modulo") << " by zero at line " << c->line << endl;
+		exit(1);
+	}
+	int l = eval(c->left, s);
+	return c->op == TOKEN_DIV ? l / r : l % r;
+}
+
+static int run_div_k(const closure* c, closure_state& s)
+{
+	return eval(c->left, s) / c->value;
+}
+
+static int run_mod_k(const closure* c, closure_state& s)
+{
+	return eval(c->left, s) % c->value;
+}
+
+static int run_and(const closure* c, closure_state& s)
+{
+	return (eval(c->left, s) != 0 && eval(c->right, s) != 0) ? 1 : 0;
+}
+
+static int run_or(const closure* c, closure_state& s)
+{
+	return (eval(c->left, s) != 0 || eval(c->right, s) != 0) ? 1 : 0;
+}
+
+static int run_not(const closure* c, closure_state& s)
+{
+	return eval(c->left, s) == 0 ? 1 : 0;
+}
+
+static int run_assign(const closure* c, closure_state& s)
+{
+	int value_to_assign = eval(c->right, s);
+	s.vars[c->value] = value_to_assign;
+	return value_to_assign;
+}
+
+static int run_read(const closure* c, closure_state& s)
+{
+	walk_read(s.ctx, c->left->value, c->line);
+	return 0;
+}
+
+static int run_print(const closure* c, closure_state& s)
+{
+	for (const closure* expr = c->left; expr != nullptr; expr = expr->next)
+	{
+		if (expr->type == vt_bool)
+		{
+			output_bool(s.ctx.output, eval(expr, s) != 0);
+		}
+		else if (expr->type == vt_string)
+		{
+			if (expr->op == TOKEN_STRING)
+			{
+				output_write(s.ctx.output, expr->text);
+			}
+		}
+		else
+		{
+			output_int(s.ctx.output, eval(expr, s));
+		}
+	}
+	return 0;
+}
+
+// A missing then branch or loop body does nothing.
+static int run_if(const closure* c, closure_state& s)
+{
+	if (eval(c->left, s) != 0)
+	{
+		return c->right != nullptr ? eval(c->right, s) : 0;
+	}
+	return c->next != nullptr ? eval(c->next, s) : 0;
+}
+
+static int run_while(const closure* c, closure_state& s)
+{
+	int last_val = 0;
+	while (eval(c->left, s) != 0)
+	{
+		last_val = c->right != nullptr ? eval(c->right, s) : 0;
+	}
+	return last_val;
+}
+
+static int run_block(const closure* c, closure_state& s)
+{
+	int last_val = 0;
+	for (const closure* statement = c->left; statement != nullptr; statement = statement->next)
+	{
+		last_val = eval(statement, s);
+	}
+	return last_val;
+}
+
+struct binary_runs
+{
+	closure_fn stack;
+	closure_fn literal;
+	closure_fn variable;
+};
+
+static const binary_runs* binary_runs_for(token_id op)
+{
+	static const binary_runs add = { run_add, run_add_k, run_add_v };
+	static const binary_runs sub = { run_sub, run_sub_k, run_sub_v };
+	static const binary_runs mul = { run_mul, run_mul_k, run_mul_v };
+	static const binary_runs less = { run_less, run_less_k, run_less_v };
+	static const binary_runs less_eq = { run_less_eq, run_less_eq_k, run_less_eq_v };
+	static const binary_runs greater = { run_greater, run_greater_k, run_greater_v };
+	static const binary_runs greater_eq = { run_greater_eq, run_greater_eq_k, run_greater_eq_v };
+	static const binary_runs equal = { run_equal, run_equal_k, run_equal_v };
+	static const binary_runs not_equal = { run_not_equal, run_not_equal_k, run_not_equal_v };
+	switch (op)
+	{
+	case TOKEN_PLUS:       return &add;
+	case TOKEN_MINUS:      return &sub;
+	case TOKEN_MULT:       return &mul;
+	case TOKEN_LESS:       return &less;
+	case TOKEN_LESS_EQ:    return &less_eq;
+	case TOKEN_GREATER:    return &greater;
+	case TOKEN_GREATER_EQ: return &greater_eq;
+	case TOKEN_EQUAL:      return &equal;
+	case TOKEN_NOT_EQUAL:  return &not_equal;
+	default:               return nullptr;
+	}
+}
+
+// Picks run for c, whose children are already converted. Anything the
+// fast functions do not cover, errors included, goes to run_deep, which
+// behaves exactly as the tree walker.
+static void choose_run(closure& c, size_t variable_count)
+{
+	auto valid = [&](int slot) { return slot >= 0 && (size_t)slot < variable_count; };
+	c.run = run_deep;
+	switch (c.op)
+	{
+	case TOKEN_INTEGER:
+		c.run = run_constant;
+		break;
+	case TOKEN_TRUE:
+		c.value = 1;
+		c.run = run_constant;
+		break;
+	case TOKEN_FALSE:
+	case TOKEN_STRING:
+	case TOKEN_INT4:
+		c.run = run_zero;
+		break;
+	case TOKEN_IDENT:
+		if (valid(c.value))
+		{
+			c.run = run_load;
+		}
+		break;
+
+	case TOKEN_MINUS:
+		if (c.left == nullptr && c.right != nullptr)
+		{
+			c.run = run_negate;
+			break;
+		}
+		// fall through
+	case TOKEN_PLUS:
+	case TOKEN_MULT:
+	case TOKEN_LESS:
+	case TOKEN_LESS_EQ:
+	case TOKEN_GREATER:
+	case TOKEN_GREATER_EQ:
+	case TOKEN_EQUAL:
+	case TOKEN_NOT_EQUAL:
+		if (c.left != nullptr && c.right != nullptr)
+		{
+			const binary_runs& runs = *binary_runs_for(c.op);
+			if (c.right->op == TOKEN_INTEGER)
+			{
+				c.value = c.right->value;
+				c.run = runs.literal;
+			}
+			else if (c.right->op == TOKEN_IDENT && valid(c.right->value))
+			{
+				c.value = c.right->value;
+				c.run = runs.variable;
+			}
+			else
+			{
+				c.run = runs.stack;
+			}
+		}
+		break;
+
+	case TOKEN_DIV:
+	case TOKEN_MOD:
+		if (c.left != nullptr && c.right != nullptr)
+		{
+			if (c.right->op == TOKEN_INTEGER && c.right->value != 0)
+			{
+				c.value = c.right->value;
+				c.run = c.op == TOKEN_DIV ? run_div_k : run_mod_k;
+			}
+			else
+			{
+				c.run = run_div;
+			}
+		}
+		break;
+
+	case TOKEN_AND:
+		c.run = run_and;
+		break;
+	case TOKEN_OR:
+		c.run = run_or;
+		break;
+	case TOKEN_NOT:
+		c.run = run_not;
+		break;
+
+	case TOKEN_ASSIGN:
+		if (c.left != nullptr && valid(c.left->value))
+		{
+			c.value = c.left->value;
+			c.run = run_assign;
+		}
+		break;
+
+	case TOKEN_PRINT:
+		c.run = run_print;
+		break;
+	case TOKEN_READ:
+		if (c.left != nullptr && c.left->op == TOKEN_IDENT && valid(c.left->value))
+		{
+			c.run = run_read;
+		}
+		break;
+	case TOKEN_IF:
+		c.run = run_if;
+		break;
+	case TOKEN_WHILE:
+		c.run = run_while;
+		break;
+	case TOKEN_BLOCK:
+		c.run = run_block;
+		break;
+	default:
+		break;
+	}
+}
+
+// Nodes are numbered in pre-order, so every node's children come after it
+// and a pass from the back sees children first. height is how deep the
+// walker would recurse below a node, counting the items of a list (which
+// it loops over) at one level; a closure higher than walk_recursion_limit
+// runs on walk_evaluate_deep, so native recursion stays as shallow as the
+// walker's.
+template <typename View, typename Roots>
+void closure_program::convert(const View& v, const compilation_context& ctx, const Roots& roots)
+{
+	typedef typename View::ref ref;
+	vector<ref> order;
+	unordered_map<ref, uint32_t> index;
+	vector<ref> stack;
+	for (ref root : roots)
+	{
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			ref n = stack.back();
+			stack.pop_back();
+			if (n == v.none() || !index.emplace(n, (uint32_t)order.size()).second)
+			{
+				continue;
+			}
+			order.push_back(n);
+			stack.push_back(v.next(n));
+			stack.push_back(v.right(n));
+			stack.push_back(v.left(n));
+		}
+	}
+
+	closures.assign(order.size(), closure());
+	auto at = [&](ref n) { return n == v.none() ? nullptr : &closures[index[n]]; };
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		ref n = order[i];
+		closure& c = closures[i];
+		c.left = at(v.left(n));
+		c.right = at(v.right(n));
+		c.next = at(v.next(n));
+		c.op = v.op(n);
+		c.type = v.type(n);
+		c.line = v.line(n);
+		c.text = c.op == TOKEN_STRING ? v.string_value(ctx, n) : v.text(n);
+		c.value = c.op == TOKEN_INTEGER ? v.integer(n) : c.op == TOKEN_IDENT ? v.symbol(n) : 0;
+	}
+	size_t variable_count = max(ctx.variable_values.size(), ctx.sym_table.size());
+	vector<int> height(order.size());
+	vector<int> chain(order.size());
+	auto height_of = [&](const closure* c) { return c == nullptr ? 0 : height[c - closures.data()]; };
+	auto chain_of = [&](const closure* c) { return c == nullptr ? 0 : chain[c - closures.data()]; };
+	for (size_t i = order.size(); i-- > 0;)
+	{
+		closure& c = closures[i];
+		int below;
+		if (c.op == TOKEN_BLOCK || c.op == TOKEN_PRINT)
+		{
+			below = chain_of(c.left);
+		}
+		else
+		{
+			below = max(height_of(c.left), height_of(c.right));
+			if (c.op == TOKEN_IF)
+			{
+				below = max(below, height_of(c.next));
+			}
+		}
+		height[i] = below + 1;
+		chain[i] = max(height[i], chain_of(c.next));
+
+		choose_run(c, variable_count);
+		if (height[i] > walk_recursion_limit)
+		{
+			c.run = run_deep;
+		}
+	}
+
+	statements.clear();
+	for (ref root : roots)
+	{
+		statements.push_back(at(root));
+	}
+}
+
+void closure_program::build(const compilation_context& ctx, const vector<node*>& program_statements)
+{
+	convert(tree_view(), ctx, program_statements);
+}
+
+void closure_program::build(const compilation_context& ctx, const compact_ast& ast)
+{
+	convert(compact_view{ ast }, ctx, ast.statements);
+}
+
+int closure_program::evaluate(compilation_context& ctx, const closure* statement) const
+{
+	if (ctx.variable_values.size() < ctx.sym_table.size())
+	{
+		ctx.variable_values.resize(ctx.sym_table.size(), 0);
+	}
+	closure_state state = { ctx, ctx.variable_values.data() };
+	return eval(statement, state);
+}
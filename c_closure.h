@@ -0,0 +1,57 @@
+#ifndef C_CLOSURE_H
+#define C_CLOSURE_H
+
+#include "c_ast.h"
+#include "c_tree.h"
+#include "context.h"
+
+#include <string_view>
+#include <vector>
+using namespace std;
+
+struct closure;
+struct closure_state;
+typedef int (*closure_fn)(const closure* c, closure_state& state);
+
+// A node converted for execution: run is chosen once for the node's
+// operator and operand kinds, so evaluating it is one indirect call.
+// value is the literal, the variable slot or the string_table id the node
+// needs; for a binary operator with a literal or variable right operand it
+// holds that operand. The rest mirrors the node, for error messages and
+// for walk_evaluate_deep, which runs subtrees too deep to recurse into.
+struct closure
+{
+	closure_fn run;
+	const closure* left;
+	const closure* right;
+	const closure* next;
+	int value;
+	token_id op;
+	value_type type;
+	int line;
+	string_view text;
+};
+
+struct closure_state
+{
+	compilation_context& ctx;
+	int* vars;
+};
+
+class closure_program
+{
+public:
+	vector<const closure*> statements;
+
+	void build(const compilation_context& ctx, const vector<node*>& program_statements);
+	void build(const compilation_context& ctx, const compact_ast& ast);
+	int evaluate(compilation_context& ctx, const closure* statement) const;
+
+private:
+	vector<closure> closures;
+
+	template <typename View, typename Roots>
+	void convert(const View& v, const compilation_context& ctx, const Roots& roots);
+};
+
+#endif
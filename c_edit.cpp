@@ -0,0 +1,513 @@
+#include "c_edit.h"
+
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+
+// Where text after an edit moved to. A node or diagnostic at or past the
+// old end of the edit moves by delta bytes; on the line the edit ended on
+// its column moves with the end of the edit, further down only its line.
+struct position_shift
+{
+	size_t old_end;
+	size_t new_end;
+	long long delta;
+	int old_line, old_col;
+	int new_line, new_col;
+
+	bool after(int line, int col) const
+	{
+		return line > old_line || (line == old_line && col >= old_col);
+	}
+
+	void apply(int& line, int& col) const
+	{
+		if (line == old_line)
+		{
+			col += new_col - old_col;
+		}
+		line += new_line - old_line;
+	}
+};
+
+static void shift_nodes(node* root, const position_shift& shift, vector<node*>& pending)
+{
+	if (root != nullptr)
+	{
+		pending.push_back(root);
+	}
+	while (!pending.empty())
+	{
+		node* n = pending.back();
+		pending.pop_back();
+		if (n->token.offset >= shift.old_end)
+		{
+			n->token.offset = (size_t)((long long)n->token.offset + shift.delta);
+			shift.apply(n->token.line, n->token.col);
+		}
+		for (node* child : { n->left, n->right, n->next })
+		{
+			if (child != nullptr)
+			{
+				pending.push_back(child);
+			}
+		}
+	}
+}
+
+// Gives a statement's nodes the move recorded for them.
+static void settle(document_statement& s, vector<node*>& pending)
+{
+	if (s.moved_bytes != 0 || s.moved_lines != 0)
+	{
+		position_shift move = { 0, 0, s.moved_bytes, 0, 0, s.moved_lines, 0 };
+		shift_nodes(s.root, move, pending);
+		s.moved_bytes = 0;
+		s.moved_lines = 0;
+	}
+}
+
+// Scans the token at pos, adding its warnings to notes. A character the
+// lexer rejects becomes a TOKEN_NULL token holding its text.
+static Token lex_at(lexer& lex, size_t pos, size_t& end, vector<token_note>& notes)
+{
+	buffer_seek(lex.source, pos);
+	Token t;
+	vector<diagnostic> warnings;
+	Error e = get_token(lex, t, warnings);
+	for (diagnostic& d : warnings)
+	{
+		notes.push_back({ t.offset, move(d) });
+	}
+	end = buffer_pos(lex.source);
+	if (e.error != NCC_OK)
+	{
+		end = max(end, t.offset + 1);
+		t.id = TOKEN_NULL;
+		t.val = string_view(buffer_at(lex.source, t.offset), end - t.offset);
+	}
+	return t;
+}
+
+// Replaces v[at, at + erase) with insert, moving the tail only when the
+// two differ in length.
+template <typename T>
+static void splice(vector<T>& v, size_t at, size_t erase, const vector<T>& insert)
+{
+	size_t common = min(erase, insert.size());
+	copy(insert.begin(), insert.begin() + common, v.begin() + at);
+	v.erase(v.begin() + at + common, v.begin() + at + erase);
+	v.insert(v.begin() + at + common, insert.begin() + common, insert.end());
+}
+
+document::document(const string& text) : source(text), tokens(), full_parse_nodes(0)
+{
+	ctx.max_errors = 0;
+	lex_init_text(ctx.lex, source.data(), source.size());
+	tokens.source = &ctx.lex.source;
+	tokens.atoms.push_back(string_view());
+
+	size_t pos = 0;
+	Token t;
+	do
+	{
+		size_t end;
+		t = lex_at(ctx.lex, pos, end, notes);
+		tokens.kind.push_back((uint8_t)t.id);
+		tokens.offset.push_back((uint32_t)t.offset);
+		tokens.length.push_back((uint32_t)(end - t.offset));
+		tokens.atom.push_back(intern(t.val));
+		pos = end;
+	} while (t.id != TOKEN_EOF);
+	tokens.error_index = tokens.size();
+
+	reparse_all();
+}
+
+// Token text outlives the source it came from, which every edit replaces.
+uint32_t document::intern(string_view text)
+{
+	size_t known = tokens.atoms.size();
+	uint32_t id = tokens.intern(text);
+	if (tokens.atoms.size() > known)
+	{
+		tokens.atoms[id] = atom_text.store(text.data(), text.size());
+	}
+	return id;
+}
+
+// One top-level statement, parsed and checked the way main does it.
+document_statement document::parse_top_level()
+{
+	document_statement s;
+	s.first = parser->token_index();
+	s.sym_begin = ctx.sym_table.size();
+	s.root = parser->parse_statement();
+	if (s.root == nullptr && parser->get_current_token().id != TOKEN_EOF)
+	{
+		parser->report("Expected a valid statement or EOF", parser->get_current_token().line, parser->get_current_token().col);
+	}
+	s.count = parser->token_index() - s.first;
+	auto note = lower_bound(notes.begin(), notes.end(), tokens.offset[s.first], [](const token_note& n, size_t offset) { return n.token_offset < offset; });
+	for (; note != notes.end() && note->token_offset < tokens.offset[s.first + s.count]; ++note)
+	{
+		s.diagnostics.push_back(note->d);
+	}
+	// Edits would leave a stored source line stale; a document has its
+	// whole text at hand instead.
+	for (diagnostic& d : ctx.diagnostics)
+	{
+		d.source_line.clear();
+		s.diagnostics.push_back(move(d));
+	}
+	ctx.diagnostics.clear();
+	vector<node*> pending;
+	if (s.root != nullptr)
+	{
+		pending.push_back(s.root);
+	}
+	while (!pending.empty())
+	{
+		node* n = pending.back();
+		pending.pop_back();
+		if (n->token.id == TOKEN_STRING)
+		{
+			s.strings.push_back(n);
+		}
+		for (node* child : { n->left, n->right, n->next })
+		{
+			if (child != nullptr)
+			{
+				pending.push_back(child);
+			}
+		}
+	}
+	sort(s.strings.begin(), s.strings.end(), [](const node* a, const node* b) { return a->token.offset < b->token.offset; });
+	s.moved_bytes = 0;
+	s.moved_lines = 0;
+	return s;
+}
+
+// Moves statements [from, end) to where an edit put them. Those starting
+// on the line the edit ended on are fixed up node by node. Every one below
+// moved by the same bytes and lines; that is only recorded, since walking
+// them all would cost more than the reparse, and applied by settle_all.
+void document::shift_statements(size_t from, const position_shift& shift)
+{
+	size_t line_end = source.find('\n', shift.new_end);
+	vector<node*> pending;
+	for (size_t i = from; i < parsed.size(); i++)
+	{
+		document_statement& s = parsed[i];
+		if (tokens.offset[s.first] < line_end)
+		{
+			settle(s, pending);
+			shift_nodes(s.root, shift, pending);
+			for (diagnostic& d : s.diagnostics)
+			{
+				if (shift.after(d.line, d.col))
+				{
+					shift.apply(d.line, d.col);
+				}
+			}
+		}
+		else
+		{
+			s.moved_bytes += shift.delta;
+			s.moved_lines += shift.new_line - shift.old_line;
+			for (diagnostic& d : s.diagnostics)
+			{
+				d.line += shift.new_line - shift.old_line;
+			}
+		}
+	}
+}
+
+void document::settle_all()
+{
+	vector<node*> pending;
+	for (document_statement& s : parsed)
+	{
+		settle(s, pending);
+	}
+}
+
+void document::reparse_all()
+{
+	ctx.sym_table.clear();
+	ctx.string_table.clear();
+	ctx.diagnostics.clear();
+	parsed.clear();
+	parser.reset();
+	parser = make_unique<parse>(ctx, tokens);
+	while (parser->get_current_token().id != TOKEN_EOF)
+	{
+		parsed.push_back(parse_top_level());
+	}
+	full_parse_nodes = parser->get_arena().node_count();
+	number_strings();
+}
+
+// Renumbers the string_table by first use in the statements, in order,
+// dropping literals no statement uses any more. The ids then depend only
+// on the text, not on the edits that led to it.
+void document::number_strings()
+{
+	vector<string> table;
+	unordered_map<string_view, int> ids;
+	for (document_statement& s : parsed)
+	{
+		for (node* n : s.strings)
+		{
+			auto found = ids.emplace(ctx.string_table[n->value], (int)table.size());
+			if (found.second)
+			{
+				table.emplace_back(found.first->first);
+			}
+			n->value = found.first->second;
+		}
+	}
+	ctx.string_table.swap(table);
+	parser->forget_strings();
+}
+
+document::edit_result document::edit(size_t offset, size_t removed, const string& inserted)
+{
+	edit_result result = { 0, 0, false };
+	offset = min(offset, source.size());
+	removed = min(removed, source.size() - offset);
+
+	position_shift shift;
+	shift.old_end = offset + removed;
+	shift.new_end = offset + inserted.size();
+	shift.delta = (long long)inserted.size() - (long long)removed;
+	buffer_line_col(ctx.lex.source, shift.old_end, shift.old_line, shift.old_col);
+	source.replace(offset, removed, inserted);
+	lex_init_text(ctx.lex, source.data(), source.size());
+	size_t new_end = shift.new_end;
+	buffer_line_col(ctx.lex.source, new_end, shift.new_line, shift.new_col);
+
+	// The lexer never looks more than one character past a token, so a
+	// token ending before the edit stays as it is. Relex from the end of
+	// the last such token until a token starts, past the edit, where an old
+	// one did; everything from there on lexes the same as before.
+	size_t lo = 0;
+	size_t hi = tokens.size();
+	while (lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+		if (tokens.offset[mid] + tokens.length[mid] < offset)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	size_t first = lo;
+	size_t pos = first > 0 ? tokens.offset[first - 1] + tokens.length[first - 1] : 0;
+
+	vector<uint8_t> kinds;
+	vector<uint32_t> offsets;
+	vector<uint32_t> lengths;
+	vector<uint32_t> atoms;
+	vector<token_note> relexed_notes;
+	size_t resume;
+	while (true)
+	{
+		size_t end;
+		vector<token_note> token_notes;
+		Token t = lex_at(ctx.lex, pos, end, token_notes);
+		result.tokens_lexed++;
+		if (t.offset >= new_end)
+		{
+			uint32_t old_offset = (uint32_t)((long long)t.offset - shift.delta);
+			auto it = lower_bound(tokens.offset.begin() + first, tokens.offset.end(), old_offset);
+			if (it != tokens.offset.end() && *it == old_offset)
+			{
+				resume = it - tokens.offset.begin();
+				break;
+			}
+		}
+		kinds.push_back((uint8_t)t.id);
+		offsets.push_back((uint32_t)t.offset);
+		lengths.push_back((uint32_t)(end - t.offset));
+		atoms.push_back(intern(t.val));
+		relexed_notes.insert(relexed_notes.end(), make_move_iterator(token_notes.begin()), make_move_iterator(token_notes.end()));
+		pos = end;
+	}
+
+	// Tokens before the edit usually come back unchanged; keep them.
+	size_t same = 0;
+	while (same < kinds.size() && first + same < resume && offsets[same] < offset && kinds[same] == tokens.kind[first + same]
+		&& offsets[same] == tokens.offset[first + same] && lengths[same] == tokens.length[first + same] && atoms[same] == tokens.atom[first + same])
+	{
+		same++;
+	}
+	first += same;
+	kinds.erase(kinds.begin(), kinds.begin() + same);
+	offsets.erase(offsets.begin(), offsets.begin() + same);
+	lengths.erase(lengths.begin(), lengths.begin() + same);
+	atoms.erase(atoms.begin(), atoms.begin() + same);
+
+	size_t old_count = resume - first;
+	size_t new_count = kinds.size();
+
+	// The notes of the replaced tokens go, those of the new ones come in,
+	// and those of later tokens move with them.
+	auto by_offset = [](const token_note& n, size_t at) { return n.token_offset < at; };
+	auto kept_from = lower_bound(relexed_notes.begin(), relexed_notes.end(), new_count > 0 ? offsets[0] : new_end, by_offset);
+	auto note_begin = lower_bound(notes.begin(), notes.end(), tokens.offset[first], by_offset);
+	auto note_end = lower_bound(note_begin, notes.end(), tokens.offset[resume], by_offset);
+	size_t moved_from = note_begin - notes.begin() + (relexed_notes.end() - kept_from);
+	splice(notes, note_begin - notes.begin(), note_end - note_begin, vector<token_note>(make_move_iterator(kept_from), make_move_iterator(relexed_notes.end())));
+	for (size_t i = moved_from; i < notes.size(); i++)
+	{
+		notes[i].token_offset = (size_t)((long long)notes[i].token_offset + shift.delta);
+		if (shift.after(notes[i].d.line, notes[i].d.col))
+		{
+			shift.apply(notes[i].d.line, notes[i].d.col);
+		}
+	}
+
+	splice(tokens.kind, first, old_count, kinds);
+	splice(tokens.offset, first, old_count, offsets);
+	splice(tokens.length, first, old_count, lengths);
+	splice(tokens.atom, first, old_count, atoms);
+	for (size_t i = first + new_count; i < tokens.size(); i++)
+	{
+		tokens.offset[i] = (uint32_t)((long long)tokens.offset[i] + shift.delta);
+	}
+	tokens.error_index = tokens.size();
+
+	if (parsed.empty())
+	{
+		reparse_all();
+		result.statements_parsed = parsed.size();
+		result.full_reparse = true;
+		return result;
+	}
+
+	// Statements [lo, hi) looked at one of the replaced tokens [first,
+	// first + old_count), or at the token new ones were inserted before.
+	size_t changed_end = max(resume, first + 1);
+	lo = partition_point(parsed.begin(), parsed.end(), [&](const document_statement& s) { return s.first + s.count < first; }) - parsed.begin();
+	hi = partition_point(parsed.begin(), parsed.end(), [&](const document_statement& s) { return s.first < changed_end; }) - parsed.begin();
+	long long token_shift = (long long)new_count - (long long)old_count;
+
+	if (old_count == 0 && new_count == 0)
+	{
+		shift_statements(lo, shift);
+		return result;
+	}
+
+	// Reparse with only the symbols declared before the first of them
+	// visible, until a statement ends where an old one past the edit
+	// started.
+	size_t sym_begin = parsed[lo].sym_begin;
+	vector<symbol_data> later(ctx.sym_table.begin() + sym_begin, ctx.sym_table.end());
+	ctx.sym_table.resize(sym_begin);
+
+	size_t strings_before = ctx.string_table.size();
+	vector<document_statement> fresh;
+	size_t reuse_from = parsed.size();
+	parser->seek(parsed[lo].first);
+	while (parser->get_current_token().id != TOKEN_EOF)
+	{
+		fresh.push_back(parse_top_level());
+		size_t next = parser->token_index();
+		if (next >= first + new_count)
+		{
+			size_t old_next = (size_t)((long long)next - token_shift);
+			auto it = partition_point(parsed.begin() + hi, parsed.end(), [&](const document_statement& s) { return s.first < old_next; });
+			if (it != parsed.end() && it->first == old_next)
+			{
+				reuse_from = it - parsed.begin();
+				break;
+			}
+		}
+	}
+	result.statements_parsed = fresh.size();
+
+	// Later statements keep their symbol indices only if the reparsed ones
+	// declared the same symbols as before.
+	size_t declared = (reuse_from < parsed.size() ? parsed[reuse_from].sym_begin - sym_begin : later.size());
+	bool same_symbols = ctx.sym_table.size() - sym_begin == declared
+		&& equal(later.begin(), later.begin() + declared, ctx.sym_table.begin() + sym_begin, [](const symbol_data& a, const symbol_data& b)
+			{
+				return a.name == b.name && a.sym_type == b.sym_type && a.val_type == b.val_type;
+			});
+	if (!same_symbols)
+	{
+		reparse_all();
+		result.statements_parsed = parsed.size();
+		result.full_reparse = true;
+		return result;
+	}
+	ctx.sym_table.insert(ctx.sym_table.end(), later.begin() + declared, later.end());
+
+	for (size_t i = reuse_from; i < parsed.size(); i++)
+	{
+		parsed[i].first = (size_t)((long long)parsed[i].first + token_shift);
+	}
+	shift_statements(reuse_from, shift);
+	bool strings_changed = ctx.string_table.size() != strings_before
+		|| any_of(parsed.begin() + lo, parsed.begin() + reuse_from, [](const document_statement& s) { return !s.strings.empty(); })
+		|| any_of(fresh.begin(), fresh.end(), [](const document_statement& s) { return !s.strings.empty(); });
+	parsed.erase(parsed.begin() + lo, parsed.begin() + reuse_from);
+	parsed.insert(parsed.begin() + lo, make_move_iterator(fresh.begin()), make_move_iterator(fresh.end()));
+
+	// Replaced subtrees stay in the parser's arena; start over once they
+	// outweigh the live tree.
+	if (parser->get_arena().node_count() > 2 * full_parse_nodes + 4096)
+	{
+		reparse_all();
+		result.full_reparse = true;
+	}
+	else if (strings_changed)
+	{
+		number_strings();
+	}
+	return result;
+}
+
+const string& document::text() const
+{
+	return source;
+}
+
+const vector<document_statement>& document::statements()
+{
+	settle_all();
+	return parsed;
+}
+
+vector<node*> document::program()
+{
+	settle_all();
+	vector<node*> roots;
+	for (const document_statement& s : parsed)
+	{
+		if (s.root != nullptr)
+		{
+			roots.push_back(s.root);
+		}
+	}
+	return roots;
+}
+
+vector<diagnostic> document::diagnostics() const
+{
+	vector<diagnostic> all;
+	for (const document_statement& s : parsed)
+	{
+		all.insert(all.end(), s.diagnostics.begin(), s.diagnostics.end());
+	}
+	return all;
+}
+
+compilation_context& document::context()
+{
+	return ctx;
+}
@@ -0,0 +1,88 @@
+#ifndef C_EDIT_H
+#define C_EDIT_H
+
+#include "c_tree.h"
+#include "context.h"
+#include "lex.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+struct position_shift;
+
+// A lexer warning and the offset of the token it came from; it is reported
+// with the statement that token ends up in.
+struct token_note
+{
+	size_t token_offset;
+	diagnostic d;
+};
+
+// A top-level statement of a document and the part of the token stream it
+// was parsed from. Besides tokens [first, first + count) the parser also
+// looked at token first + count, to see that the statement had ended.
+// moved_bytes and moved_lines are a move its nodes have not been given
+// yet; they are always zero once the document hands the statement out.
+// strings are the string literals in the tree, in source order.
+struct document_statement
+{
+	node* root;
+	size_t first;
+	size_t count;
+	size_t sym_begin;
+	vector<node*> strings;
+	vector<diagnostic> diagnostics;
+	long long moved_bytes;
+	int moved_lines;
+};
+
+// Source text kept lexed and parsed across edits, for editor integration.
+// An edit re-lexes only the tokens it can change and reparses only the
+// top-level statements that looked at one of them; the other statements
+// keep their subtrees and, while the declarations in the reparsed part stay
+// the same, their sym_table entries. Unlike a file, a document never exits
+// on an error: a character the lexer rejects becomes a TOKEN_NULL token and
+// is reported by the parser like any other unexpected token.
+class document
+{
+public:
+	struct edit_result
+	{
+		size_t tokens_lexed;
+		size_t statements_parsed;
+		bool full_reparse;
+	};
+
+	document(const string& text);
+	document(const document&) = delete;
+	document& operator=(const document&) = delete;
+
+	edit_result edit(size_t offset, size_t removed, const string& inserted);
+
+	const string& text() const;
+	const vector<document_statement>& statements();
+	vector<node*> program();
+	vector<diagnostic> diagnostics() const;
+	compilation_context& context();
+
+private:
+	string source;
+	compilation_context ctx;
+	token_stream tokens;
+	text_arena atom_text;
+	unique_ptr<parse> parser;
+	vector<document_statement> parsed;
+	vector<token_note> notes;
+	size_t full_parse_nodes;
+
+	uint32_t intern(string_view text);
+	void reparse_all();
+	void number_strings();
+	document_statement parse_top_level();
+	void shift_statements(size_t from, const position_shift& shift);
+	void settle_all();
+};
+
+#endif
@@ -1,11 +1,12 @@
 #include "c_gen.h"
+#include "c_walk.h"
 #include <iostream>
 #include <vector>
 #include <map>
 #include <stdexcept>
 #include <iterator>
 
-code_gen::code_gen(vector<uint8_t>& bin, vector<symbol_data>& sym) : binary(bin), symbols(sym), label_counter(0) {}
+code_gen::code_gen(vector<uint8_t>& bin, compilation_context& ctx) : binary(bin), symbols(ctx.sym_table), context(ctx), label_counter(0) {}
 
 int code_gen::new_label()
 {
@@ -268,184 +269,256 @@ void code_gen::jump()
     }
 }
 
-void generate_node_code(node* n, code_gen& ctx)
+// Emits code for n and, except after an if (whose next is its else
+// branch), for the statements chained after it. Each frame's stage says
+// how much of its node has been emitted.
+template <typename View>
+static void walk_generate(const View& v, typename View::ref root, code_gen& ctx)
 {
-    if (!n)
-    {
-        return;
-    }
-    switch (n->token.id)
+    typedef typename View::ref ref;
+    struct frame
     {
-    case TOKEN_INTEGER:
-        ctx.mov_eax_imm(stoi(n->token.val));
-        break;
-    case TOKEN_TRUE:
-        ctx.binary.push_back(0xB0);
-        ctx.binary.push_back(0x01);
-        break;
-    case TOKEN_FALSE:
-        ctx.binary.push_back(0xB0);
-        ctx.binary.push_back(0x00);
-        break;
-    case TOKEN_STRING:
-        ctx.mov_eax_imm(0);
-        break;
-    case TOKEN_IDENT:
-        ctx.mov_eax_var(n->symbol_table_index);
-        break;
-
-    case TOKEN_PLUS:
-    case TOKEN_MINUS:
-    case TOKEN_MULT:
-    case TOKEN_DIV:
-    case TOKEN_MOD:
+        ref n;
+        int stage;
+        int label_a;
+        int label_b;
+    };
+    vector<frame> frames;
+
+    auto call = [&](ref n)
     {
-        generate_node_code(n->right, ctx);
-        ctx.push_eax();
-        generate_node_code(n->left, ctx);
-        ctx.pop_ebx();
-        if (n->token.id == TOKEN_PLUS)
-        {
-            ctx.add_eax_ebx();
-        }
-        else if (n->token.id == TOKEN_MINUS)
+        if (n != v.none())
         {
-            ctx.sub_eax_ebx();
+            frames.push_back({ n, 0, 0, 0 });
         }
-        else if (n->token.id == TOKEN_MULT)
-        {
-            ctx.imul_eax_ebx();
-        }
-        else if (n->token.id == TOKEN_DIV || n->token.id == TOKEN_MOD)
-        {
-            ctx.cdq();
-            ctx.idiv_ebx();
-            if (n->token.id == TOKEN_MOD)
-            {
-                ctx.mov_eax_edx();
-            }
-        }
-    }
-    break;
-    case TOKEN_LESS:
-    case TOKEN_LESS_EQ:
-    case TOKEN_GREATER:
-    case TOKEN_GREATER_EQ:
-    case TOKEN_EQUAL:
-    case TOKEN_NOT_EQUAL:
-    {
-        generate_node_code(n->right, ctx);
-        ctx.push_eax();
-        generate_node_code(n->left, ctx);
-        ctx.pop_ebx();
-        ctx.cmp_eax_ebx();
-        ctx.setcc_al(n->token.id);
-    }
-    break;
-    case TOKEN_NOT:
-        generate_node_code(n->left, ctx);
-        ctx.xor_al_imm8(1);
-        break;
-    case TOKEN_AND:
-    {
-        int end_label = ctx.new_label();
-        generate_node_code(n->left, ctx);
-        ctx.test_al_al();
-        ctx.jcc_rel32(TOKEN_FALSE, true, end_label);
-        generate_node_code(n->right, ctx);
-        ctx.place_label(end_label);
-    }
-    break;
-    case TOKEN_OR:
+    };
+    // Done with the top frame: go on with its next statement, if any.
+    auto finish = [&](bool chain)
     {
-        int end_label = ctx.new_label();
-        generate_node_code(n->left, ctx);
-        ctx.test_al_al();
-        ctx.jcc_rel32(TOKEN_TRUE, true, end_label);
-        generate_node_code(n->right, ctx);
-        ctx.place_label(end_label);
-    }
-    break;
-
-    case TOKEN_ASSIGN:
-    {
-        if (n->left == nullptr || n->left->token.id != TOKEN_IDENT)
+        ref n = frames.back().n;
+        frames.pop_back();
+        if (chain && v.op(n) != TOKEN_IF)
         {
-            return;
+            call(v.next(n));
         }
-        generate_node_code(n->right, ctx);
-        ctx.mov_var_eax(n->left->symbol_table_index);
-    }
-    break;
+    };
 
-    case TOKEN_PRINT:
-        if (n->left)
-        {
-            generate_node_code(n->left, ctx);
-        }
-        break;
-    case TOKEN_READ:
-        if (n->left && n->left->token.id == TOKEN_IDENT)
-        {
-        }
-        break;
-    case TOKEN_INT4:
-        break;
-
-    case TOKEN_IF:
+    call(root);
+    while (!frames.empty())
     {
-        int else_label = ctx.new_label();
-        int end_if_label = ctx.new_label();
-        bool has_else = (n->next != nullptr);
-
-        generate_node_code(n->left, ctx);
-        ctx.test_al_al();
-        ctx.jcc_rel32(TOKEN_FALSE, true, has_else ? else_label : end_if_label);
+        frame& f = frames.back();
+        ref n = f.n;
+        token_id op = v.op(n);
+        switch (op)
+        {
+        case TOKEN_INTEGER:
+            ctx.mov_eax_imm(v.integer(n));
+            finish(true);
+            break;
+        case TOKEN_TRUE:
+        case TOKEN_FALSE:
+            ctx.binary.push_back(0xB0);
+            ctx.binary.push_back(op == TOKEN_TRUE ? 0x01 : 0x00);
+            finish(true);
+            break;
+        case TOKEN_STRING:
+            ctx.mov_eax_imm(0);
+            finish(true);
+            break;
+        case TOKEN_IDENT:
+            ctx.mov_eax_var(v.symbol(n));
+            finish(true);
+            break;
+
+        case TOKEN_PLUS:
+        case TOKEN_MINUS:
+        case TOKEN_MULT:
+        case TOKEN_DIV:
+        case TOKEN_MOD:
+        case TOKEN_LESS:
+        case TOKEN_LESS_EQ:
+        case TOKEN_GREATER:
+        case TOKEN_GREATER_EQ:
+        case TOKEN_EQUAL:
+        case TOKEN_NOT_EQUAL:
+            if (f.stage == 0)
+            {
+                f.stage = 1;
+                call(v.right(n));
+                break;
+            }
+            if (f.stage == 1)
+            {
+                f.stage = 2;
+                ctx.push_eax();
+                call(v.left(n));
+                break;
+            }
+            ctx.pop_ebx();
+            if (op == TOKEN_PLUS)
+            {
+                ctx.add_eax_ebx();
+            }
+            else if (op == TOKEN_MINUS)
+            {
+                ctx.sub_eax_ebx();
+            }
+            else if (op == TOKEN_MULT)
+            {
+                ctx.imul_eax_ebx();
+            }
+            else if (op == TOKEN_DIV || op == TOKEN_MOD)
+            {
+                ctx.cdq();
+                ctx.idiv_ebx();
+                if (op == TOKEN_MOD)
+                {
+                    ctx.mov_eax_edx();
+                }
+            }
+            else
+            {
+                ctx.cmp_eax_ebx();
+                ctx.setcc_al(op);
+            }
+            finish(true);
+            break;
+        case TOKEN_NOT:
+            if (f.stage == 0)
+            {
+                f.stage = 1;
+                call(v.left(n));
+                break;
+            }
+            ctx.xor_al_imm8(1);
+            finish(true);
+            break;
+        case TOKEN_AND:
+        case TOKEN_OR:
+            if (f.stage == 0)
+            {
+                f.stage = 1;
+                f.label_a = ctx.new_label();
+                call(v.left(n));
+                break;
+            }
+            if (f.stage == 1)
+            {
+                f.stage = 2;
+                ctx.test_al_al();
+                ctx.jcc_rel32(op == TOKEN_AND ? TOKEN_FALSE : TOKEN_TRUE, true, f.label_a);
+                call(v.right(n));
+                break;
+            }
+            ctx.place_label(f.label_a);
+            finish(true);
+            break;
 
-        generate_node_code(n->right, ctx);
+        case TOKEN_ASSIGN:
+            if (v.left(n) == v.none() || v.op(v.left(n)) != TOKEN_IDENT)
+            {
+                finish(false);
+                break;
+            }
+            if (f.stage == 0)
+            {
+                f.stage = 1;
+                call(v.right(n));
+                break;
+            }
+            ctx.mov_var_eax(v.symbol(v.left(n)));
+            finish(true);
+            break;
 
-        if (has_else)
-        {
-            ctx.jmp_rel32(end_if_label);
-            ctx.place_label(else_label);
-            generate_node_code(n->next, ctx);
+        case TOKEN_PRINT:
+        case TOKEN_BLOCK:
+            if (f.stage == 0)
+            {
+                f.stage = 1;
+                call(v.left(n));
+                break;
+            }
+            finish(true);
+            break;
+        case TOKEN_READ:
+        case TOKEN_INT4:
+            finish(true);
+            break;
+
+        case TOKEN_IF:
+            if (f.stage == 0)
+            {
+                f.stage = 1;
+                f.label_a = ctx.new_label();
+                f.label_b = ctx.new_label();
+                call(v.left(n));
+                break;
+            }
+            if (f.stage == 1)
+            {
+                f.stage = 2;
+                ctx.test_al_al();
+                ctx.jcc_rel32(TOKEN_FALSE, true, v.next(n) != v.none() ? f.label_a : f.label_b);
+                call(v.right(n));
+                break;
+            }
+            if (f.stage == 2 && v.next(n) != v.none())
+            {
+                f.stage = 3;
+                ctx.jmp_rel32(f.label_b);
+                ctx.place_label(f.label_a);
+                call(v.next(n));
+                break;
+            }
+            ctx.place_label(f.label_b);
+            finish(false);
+            break;
+        case TOKEN_WHILE:
+            if (f.stage == 0)
+            {
+                f.stage = 1;
+                f.label_a = ctx.new_label();
+                f.label_b = ctx.new_label();
+                ctx.jmp_rel32(f.label_b);
+                ctx.place_label(f.label_a);
+                call(v.right(n));
+                break;
+            }
+            if (f.stage == 1)
+            {
+                f.stage = 2;
+                ctx.place_label(f.label_b);
+                call(v.left(n));
+                break;
+            }
+            ctx.test_al_al();
+            ctx.jcc_rel32(TOKEN_TRUE, true, f.label_a);
+            finish(true);
+            break;
+
+        default:
+            cerr << "Error: node type: " << op << endl;
+            ctx.binary.push_back(0xCC);
+            finish(true);
         }
-        ctx.place_label(end_if_label);
     }
-    break;
-    case TOKEN_WHILE:
-    {
-        int loop_start_label = ctx.new_label();
-        int loop_test_label = ctx.new_label();
-
-        ctx.jmp_rel32(loop_test_label);
-        ctx.place_label(loop_start_label);
-        generate_node_code(n->right, ctx);
-        ctx.place_label(loop_test_label);
-        generate_node_code(n->left, ctx);
-        ctx.test_al_al();
-        ctx.jcc_rel32(TOKEN_TRUE, true, loop_start_label);
-    }
-    break;
-    case TOKEN_BLOCK:
-        generate_node_code(n->left, ctx);
-        break;
+}
 
-    default:
-        cerr << "Error: node type: " << n->token.id << endl;
-        ctx.binary.push_back(0xCC);
-    }
+void generate_node_code(node* n, code_gen& ctx)
+{
+    walk_generate(tree_view(), n, ctx);
+}
 
-    if (n->next != nullptr && n->token.id != TOKEN_IF)
-    {
-        generate_node_code(n->next, ctx);
-    }
+void generate_node_code(const compact_ast& ast, uint32_t n, code_gen& ctx)
+{
+    walk_generate(compact_view{ ast }, n, ctx);
 }
 
-void generate_program_code(node* program_ast_head, vector<uint8_t>& binary, vector<symbol_data>& symbols)
+void generate_program_code(node* program_ast_head, vector<uint8_t>& binary, compilation_context& context)
 {
     binary.clear();
-    code_gen ctx(binary, symbols);
+    code_gen ctx(binary, context);
+    vector<symbol_data>& symbols = context.sym_table;
 
     ctx.push_ebx();
     binary.push_back(0x55);
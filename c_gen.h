@@ -8,17 +8,19 @@
 #include "token.h"
 #include "s_table.h"
 #include "c_tree.h"
+#include "c_ast.h"
 
 struct code_gen
 {
     vector<uint8_t>& binary;
     int label_counter = 0;
     vector<symbol_data>& symbols;
+    compilation_context& context;
 
     map<size_t, int> jump_patch_locations;
     map<int, size_t> label_addresses;
 
-    code_gen(vector<uint8_t>& bin, vector<symbol_data>& sym);
+    code_gen(vector<uint8_t>& bin, compilation_context& ctx);
 
     int new_label();
     void place_label(int label_id);
@@ -52,7 +54,8 @@ struct code_gen
 
 };
 void generate_node_code(node* n, code_gen& ctx);
-void generate_program_code(node* program_ast_head, vector<uint8_t>& binary, vector<symbol_data>& symbols);
+void generate_node_code(const compact_ast& ast, uint32_t n, code_gen& ctx);
+void generate_program_code(node* program_ast_head, vector<uint8_t>& binary, compilation_context& context);
 
 
 #endif
\ No newline at end of file
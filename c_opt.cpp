@@ -0,0 +1,397 @@
+#include "c_opt.h"
+#include "c_walk.h"
+
+#include <charconv>
+#include <climits>
+
+// A rewriter is a view that can also change a node in place. Only the node
+// itself changes: its next link is the else branch of an if and the link
+// to the following statement of a block or argument of a print, so it is
+// kept unless the caller knows nothing can follow the node.
+struct tree_rewriter : tree_view
+{
+	text_arena& texts;
+
+	node* at(ref n) const { return const_cast<node*>(n); }
+
+	bool integer_literal(ref n, int& value) const
+	{
+		if (n->token.id != TOKEN_INTEGER)
+		{
+			return false;
+		}
+		value = n->value;
+		return true;
+	}
+
+	void make_integer(ref n, int value) const
+	{
+		char digits[16];
+		to_chars_result r = to_chars(digits, digits + sizeof(digits), value);
+		node* m = at(n);
+		m->token.id = TOKEN_INTEGER;
+		m->token.val = texts.store(digits, r.ptr - digits);
+		m->value = value;
+		m->left = nullptr;
+		m->right = nullptr;
+		m->val_type = vt_int4;
+	}
+
+	void make_bool(ref n, bool value) const
+	{
+		node* m = at(n);
+		m->token.id = value ? TOKEN_TRUE : TOKEN_FALSE;
+		m->token.val = value ? "true" : "false";
+		m->left = nullptr;
+		m->right = nullptr;
+		m->val_type = vt_bool;
+	}
+
+	void make_empty(ref n) const
+	{
+		node* m = at(n);
+		m->token.id = TOKEN_BLOCK;
+		m->token.val = "{...}";
+		m->left = nullptr;
+		m->right = nullptr;
+		m->val_type = vt_null;
+	}
+
+	void copy(ref n, ref from, bool keep_next) const
+	{
+		node* m = at(n);
+		node* next = m->next;
+		*m = *from;
+		if (keep_next)
+		{
+			m->next = next;
+		}
+	}
+
+	void set_next(ref n, ref next) const { at(n)->next = at(next); }
+};
+
+struct compact_rewriter : compact_view
+{
+	ast_node* nodes;
+
+	bool integer_literal(ref n, int& value) const
+	{
+		if (nodes[n].op != TOKEN_INTEGER)
+		{
+			return false;
+		}
+		value = nodes[n].operand;
+		return true;
+	}
+
+	void make_leaf(ref n, uint8_t op, value_type type, int operand) const
+	{
+		nodes[n].op = op;
+		nodes[n].val_type = (uint8_t)type;
+		nodes[n].left = ast_none;
+		nodes[n].right = ast_none;
+		nodes[n].operand = operand;
+	}
+
+	void make_integer(ref n, int value) const { make_leaf(n, TOKEN_INTEGER, vt_int4, value); }
+	void make_bool(ref n, bool value) const { make_leaf(n, value ? TOKEN_TRUE : TOKEN_FALSE, vt_bool, 0); }
+	void make_empty(ref n) const { make_leaf(n, TOKEN_BLOCK, vt_null, 0); }
+
+	void copy(ref n, ref from, bool keep_next) const
+	{
+		uint32_t next = nodes[n].next;
+		nodes[n] = nodes[from];
+		if (keep_next)
+		{
+			nodes[n].next = next;
+		}
+	}
+
+	void set_next(ref n, ref next) const { nodes[n].next = next; }
+};
+
+// Arithmetic wraps like the int arithmetic of the evaluator.
+static int wrap(unsigned value)
+{
+	return (int)value;
+}
+
+template <typename Rewriter>
+static bool bool_literal(const Rewriter& w, typename Rewriter::ref n, bool& value)
+{
+	value = w.op(n) == TOKEN_TRUE;
+	return w.op(n) == TOKEN_TRUE || w.op(n) == TOKEN_FALSE;
+}
+
+template <typename Rewriter>
+static void fold_expression(const Rewriter& w, typename Rewriter::ref n)
+{
+	token_id op = w.op(n);
+	int l = 0;
+	int r = 0;
+	bool lb = false;
+	bool rb = false;
+	switch (op)
+	{
+	case TOKEN_MINUS:
+		if (w.left(n) == w.none())
+		{
+			if (w.integer_literal(w.right(n), r))
+			{
+				w.make_integer(n, wrap(0u - (unsigned)r));
+			}
+			return;
+		}
+		// fall through
+	case TOKEN_PLUS:
+	case TOKEN_MULT:
+	case TOKEN_DIV:
+	case TOKEN_MOD:
+	case TOKEN_LESS:
+	case TOKEN_LESS_EQ:
+	case TOKEN_GREATER:
+	case TOKEN_GREATER_EQ:
+	case TOKEN_EQUAL:
+	case TOKEN_NOT_EQUAL:
+	{
+		bool lc = w.integer_literal(w.left(n), l);
+		bool rc = w.integer_literal(w.right(n), r);
+		if (lc && rc)
+		{
+			switch (op)
+			{
+			case TOKEN_PLUS:       w.make_integer(n, wrap((unsigned)l + (unsigned)r)); break;
+			case TOKEN_MINUS:      w.make_integer(n, wrap((unsigned)l - (unsigned)r)); break;
+			case TOKEN_MULT:       w.make_integer(n, wrap((unsigned)l * (unsigned)r)); break;
+			case TOKEN_LESS:       w.make_bool(n, l < r); break;
+			case TOKEN_LESS_EQ:    w.make_bool(n, l <= r); break;
+			case TOKEN_GREATER:    w.make_bool(n, l > r); break;
+			case TOKEN_GREATER_EQ: w.make_bool(n, l >= r); break;
+			case TOKEN_EQUAL:      w.make_bool(n, l == r); break;
+			case TOKEN_NOT_EQUAL:  w.make_bool(n, l != r); break;
+			default:
+				// Left to fail (or trap) at run time.
+				if (r != 0 && !(l == INT_MIN && r == -1))
+				{
+					w.make_integer(n, op == TOKEN_DIV ? l / r : l % r);
+				}
+				break;
+			}
+			return;
+		}
+
+		if (w.type(n) != vt_int4 || w.type(w.left(n)) != vt_int4 || w.type(w.right(n)) != vt_int4)
+		{
+			return;
+		}
+		if ((op == TOKEN_PLUS && rc && r == 0) || (op == TOKEN_MINUS && rc && r == 0) || (op == TOKEN_MULT && rc && r == 1))
+		{
+			w.copy(n, w.left(n), true);
+		}
+		else if ((op == TOKEN_PLUS && lc && l == 0) || (op == TOKEN_MULT && lc && l == 1))
+		{
+			w.copy(n, w.right(n), true);
+		}
+		else if (op == TOKEN_MINUS && w.op(w.left(n)) == TOKEN_IDENT && w.op(w.right(n)) == TOKEN_IDENT
+			&& w.symbol(w.left(n)) == w.symbol(w.right(n)))
+		{
+			w.make_integer(n, 0);
+		}
+		return;
+	}
+
+	case TOKEN_NOT:
+		if (bool_literal(w, w.left(n), lb))
+		{
+			w.make_bool(n, !lb);
+		}
+		else if (w.op(w.left(n)) == TOKEN_NOT)
+		{
+			w.copy(n, w.left(w.left(n)), true);
+		}
+		return;
+
+	case TOKEN_AND:
+	case TOKEN_OR:
+		// The right operand only runs when the left one does not decide.
+		if (bool_literal(w, w.left(n), lb))
+		{
+			if (lb == (op == TOKEN_OR))
+			{
+				w.make_bool(n, lb);
+			}
+			else
+			{
+				w.copy(n, w.right(n), true);
+			}
+		}
+		else if (bool_literal(w, w.right(n), rb) && rb == (op == TOKEN_AND))
+		{
+			w.copy(n, w.left(n), true);
+		}
+		return;
+
+	default:
+		return;
+	}
+}
+
+// A statement in a block list is followed through its next link whatever
+// it is, so an if there has no else of its own: its next is the following
+// statement, which also runs as the else. Such a statement can only take
+// over a branch that keeps that link meaning the same.
+template <typename Rewriter>
+static void fold_statement(const Rewriter& w, typename Rewriter::ref n, bool listed)
+{
+	typedef typename Rewriter::ref ref;
+	bool taken_branch;
+	if (!bool_literal(w, w.left(n), taken_branch))
+	{
+		return;
+	}
+
+	if (w.op(n) == TOKEN_WHILE)
+	{
+		if (!taken_branch)
+		{
+			w.make_empty(n);
+			if (!listed)
+			{
+				w.set_next(n, w.none());
+			}
+		}
+		return;
+	}
+
+	// An if without a then branch is left to the evaluator.
+	ref taken = taken_branch ? w.right(n) : w.next(n);
+	if (taken_branch && taken == w.none())
+	{
+		return;
+	}
+	if (taken == w.none())
+	{
+		w.make_empty(n);
+		if (!listed)
+		{
+			w.set_next(n, w.none());
+		}
+	}
+	else if (!listed)
+	{
+		w.copy(n, taken, false);
+	}
+	else if (w.op(taken) != TOKEN_IF || w.next(taken) == w.next(n))
+	{
+		w.copy(n, taken, true);
+	}
+}
+
+enum fold_kind
+{
+	fold_expr,
+	fold_arguments,
+	fold_statement_alone,
+	fold_statement_listed,
+	fold_list
+};
+
+// Post-order over one top-level statement on an explicit stack, so the
+// children of a node are folded before it is.
+template <typename Rewriter>
+static void optimize_walk(const Rewriter& w, typename Rewriter::ref root)
+{
+	typedef typename Rewriter::ref ref;
+	struct task
+	{
+		ref n;
+		fold_kind kind;
+		bool children_done;
+	};
+	static thread_local vector<task> task_stack;
+	vector<task>& tasks = task_stack;
+
+	tasks.clear();
+	tasks.push_back({ root, fold_statement_alone, false });
+	while (!tasks.empty())
+	{
+		task t = tasks.back();
+		tasks.pop_back();
+		ref n = t.n;
+		if (n == w.none())
+		{
+			continue;
+		}
+		if (t.kind == fold_arguments || t.kind == fold_list)
+		{
+			tasks.push_back({ w.next(n), t.kind, false });
+			tasks.push_back({ n, t.kind == fold_list ? fold_statement_listed : fold_expr, false });
+			continue;
+		}
+		if (t.children_done)
+		{
+			if (t.kind == fold_expr)
+			{
+				fold_expression(w, n);
+			}
+			else if (w.op(n) == TOKEN_IF || w.op(n) == TOKEN_WHILE)
+			{
+				fold_statement(w, n, t.kind == fold_statement_listed);
+			}
+			continue;
+		}
+
+		tasks.push_back({ n, t.kind, true });
+		if (t.kind == fold_expr)
+		{
+			tasks.push_back({ w.right(n), fold_expr, false });
+			tasks.push_back({ w.left(n), fold_expr, false });
+			continue;
+		}
+		switch (w.op(n))
+		{
+		case TOKEN_ASSIGN:
+			tasks.push_back({ w.right(n), fold_expr, false });
+			break;
+		case TOKEN_PRINT:
+			tasks.push_back({ w.left(n), fold_arguments, false });
+			break;
+		case TOKEN_IF:
+			if (t.kind == fold_statement_alone)
+			{
+				tasks.push_back({ w.next(n), fold_statement_alone, false });
+			}
+			tasks.push_back({ w.right(n), fold_statement_alone, false });
+			tasks.push_back({ w.left(n), fold_expr, false });
+			break;
+		case TOKEN_WHILE:
+			tasks.push_back({ w.right(n), fold_statement_alone, false });
+			tasks.push_back({ w.left(n), fold_expr, false });
+			break;
+		case TOKEN_BLOCK:
+			tasks.push_back({ w.left(n), fold_list, false });
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+void optimize(compilation_context& ctx, const vector<node*>& program_statements)
+{
+	tree_rewriter w{ {}, ctx.lex.arena };
+	for (node* statement : program_statements)
+	{
+		optimize_walk(w, statement);
+	}
+}
+
+void optimize(compact_ast& ast)
+{
+	compact_rewriter w{ { ast }, ast.node_data };
+	for (uint32_t statement : ast.statements)
+	{
+		optimize_walk(w, statement);
+	}
+}
@@ -0,0 +1,19 @@
+#ifndef C_OPT_H
+#define C_OPT_H
+
+#include "c_ast.h"
+#include "c_tree.h"
+#include "context.h"
+
+#include <vector>
+using namespace std;
+
+// Folds constant subtrees, applies the identities x*1, x+0, x-0, x-x and
+// !!b, and drops the branch of an if or while whose condition is constant.
+// Nodes are rewritten in place, so run it after the tree has been printed.
+// A division or modulo that could fail is never folded away; it still
+// fails at run time, at the same line.
+void optimize(compilation_context& ctx, const vector<node*>& program_statements);
+void optimize(compact_ast& ast);
+
+#endif
@@ -1,286 +1,189 @@
 #include "c_tree.h"
+#include "c_walk.h"
 
-node::node(const Token& t) : token(t), left(nullptr), right(nullptr), next(nullptr), val_type(vt_null), symbol_table_index(-1) {}
-node::node(const Token& t, node* l, node* r) : token(t), left(l), right(r), next(nullptr), val_type(vt_null), symbol_table_index(-1) {}
-node::~node()
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <thread>
+#include <unordered_map>
+
+node::node(const Token& t) : token(t), left(nullptr), right(nullptr), next(nullptr), val_type(vt_null), symbol_table_index(-1), value(0) {}
+node::node(const Token& t, node* l, node* r) : token(t), left(l), right(r), next(nullptr), val_type(vt_null), symbol_table_index(-1), value(0) {}
+
+static_assert(is_trivially_destructible<node>::value, "node_arena never runs node destructors");
+
+static const size_t arena_first_block = 256;
+static const size_t arena_max_block = 64 * 1024;
+
+node_arena::node_arena() : cursor(nullptr), left(0), count(0), reserved(0) {}
+
+node* node_arena::allocate()
 {
-	delete left;
-	delete right;
+	if (left == 0)
+	{
+		size_t nodes = blocks.empty() ? arena_first_block : min(arena_max_block, reserved / sizeof(node));
+		blocks.emplace_back(new char[nodes * sizeof(node)]);
+		cursor = blocks.back().get();
+		left = nodes;
+		reserved += nodes * sizeof(node);
+	}
+	node* n = reinterpret_cast<node*>(cursor);
+	cursor += sizeof(node);
+	left--;
+	count++;
+	return n;
 }
 
-vector<int> variable_values;
-extern vector<symbol_data> sym_table;
+node* node_arena::make(const Token& t)
+{
+	return new (allocate()) node(t);
+}
 
-int evaluate_statement_list(const node* statement_head)
+node* node_arena::make(const Token& t, node* l, node* r)
 {
-	int last_val = 0;
-	const node* current = statement_head;
-	while (current != nullptr)
-	{
-		if (variable_values.size() < sym_table.size())
-		{
-			variable_values.resize(sym_table.size(), 0);
-		}
-		last_val = current->evaluate();
-		current = current->next;
-	}
-	return last_val;
+	return new (allocate()) node(t, l, r);
 }
 
-int node::evaluate() const
+size_t node_arena::node_count() const
 {
-	if (variable_values.size() < sym_table.size())
-	{
-		variable_values.resize(sym_table.size(), 0);
-	}
+	return count;
+}
 
-	if (token.id == TOKEN_INTEGER)
-	{
-		return stoi(token.val);
-	}
-	if (token.id == TOKEN_TRUE)
-	{
-		return 1;
-	}
-	if (token.id == TOKEN_FALSE)
-	{
-		return 0;
-	}
-	if (token.id == TOKEN_STRING)
-	{
-		return 0;
-	}
+size_t node_arena::bytes_used() const
+{
+	return count * sizeof(node);
+}
 
-	if (token.id == TOKEN_IDENT)
-	{
-		if (symbol_table_index < 0 || symbol_table_index >= variable_values.size())
-		{
-			cerr << "Runtime Error: Invalid symbol table index " << symbol_table_index << " for " << token.val << endl;
-			exit(1);
-		}
-		return variable_values[symbol_table_index];
-	}
-	if (token.id == TOKEN_PLUS)
-	{
-		return left->evaluate() + right->evaluate();
-	}
-	else if (token.id == TOKEN_MINUS)
-	{
-		if (left == nullptr && right != nullptr)
-		{
-			return -right->evaluate();
-		}
-		else if (left != nullptr && right != nullptr)
-		{
-			return left->evaluate() - right->evaluate();
-		}
-		else
-		{
-			cerr << "Runtime Error: Invalid structure for TOKEN_MINUS node at line " << token.line << endl;
-			exit(1);
-		}
-	}
-	if (token.id == TOKEN_MULT)
-	{
-		return left->evaluate() * right->evaluate();
-	}
-	if (token.id == TOKEN_DIV)
-	{
-		int right_val = right->evaluate();
-		if (right_val == 0)
-		{
-			cerr << "Runtime Error: Division by zero at line " << token.line << endl;
-			exit(1);
-		}
-		return left->evaluate() / right_val;
-	}
-	if (token.id == TOKEN_MOD)
-	{
-		int right_val = right->evaluate();
-		if (right_val == 0) {
-			cerr << "Runtime Error: Modulo by zero at line " << token.line << endl;
-			exit(1);
-		}
-		return left->evaluate() % right_val;
-	}
+size_t node_arena::bytes_reserved() const
+{
+	return reserved;
+}
 
-	if (token.id == TOKEN_LESS)
-	{
-		return left->evaluate() < right->evaluate() ? 1 : 0;
-	}
-	if (token.id == TOKEN_LESS_EQ)
-	{
-		return left->evaluate() <= right->evaluate() ? 1 : 0;
-	}
-	if (token.id == TOKEN_GREATER)
-	{
-		return left->evaluate() > right->evaluate() ? 1 : 0;
-	}
-	if (token.id == TOKEN_GREATER_EQ)
-	{
-		return left->evaluate() >= right->evaluate() ? 1 : 0;
-	}
-	if (token.id == TOKEN_EQUAL)
-	{
-		return left->evaluate() == right->evaluate() ? 1 : 0;
-	}
-	if (token.id == TOKEN_NOT_EQUAL)
-	{
-		return left->evaluate() != right->evaluate() ? 1 : 0;
-	}
-	if (token.id == TOKEN_AND)
-	{
-		return (left->evaluate() != 0 && right->evaluate() != 0) ? 1 : 0;
-	}
-	if (token.id == TOKEN_OR)
-	{
-		return (left->evaluate() != 0 || right->evaluate() != 0) ? 1 : 0;
-	}
-	if (token.id == TOKEN_NOT)
+int evaluate_statement_list(compilation_context& ctx, const node* statement_head)
+{
+	if (ctx.verified)
 	{
-		return left->evaluate() == 0 ? 1 : 0;
+		return walk_evaluate_list<tree_view, false>(tree_view(), ctx, statement_head);
 	}
+	return walk_evaluate_list(tree_view(), ctx, statement_head);
+}
 
-	if (token.id == TOKEN_ASSIGN)
+int node::evaluate(compilation_context& ctx) const
+{
+	if (ctx.verified)
 	{
-		int target_var_index = left->symbol_table_index;
-		int value_to_assign = right->evaluate();
-		if (target_var_index < 0 || target_var_index >= variable_values.size())
-		{
-			exit(1);
-		}
-		variable_values[target_var_index] = value_to_assign;
-		return value_to_assign;
+		return walk_evaluate<tree_view, false>(tree_view(), ctx, this);
 	}
+	return walk_evaluate(tree_view(), ctx, this);
+}
 
-	if (token.id == TOKEN_PRINT)
-	{
-		node* expr = left;
-		while (expr != nullptr)
-		{
-			if (expr->val_type == vt_bool)
-			{
-				cout << (expr->evaluate() ? "true" : "false");
-			}
-			else if (expr->val_type == vt_string)
-			{
-				if (expr->token.id == TOKEN_STRING)
-				{
-					cout << expr->token.val;
-				}
-			}
-			else
-			{
-				cout << expr->evaluate();
-			}
-			expr = expr->next;
-		}
-		return 0;
-	}
+bool verify_program(compilation_context& ctx, const vector<node*>& program_statements)
+{
+	return walk_verify_program(tree_view(), ctx, program_statements);
+}
 
-	if (token.id == TOKEN_READ)
-	{
-		if (left == nullptr || left->token.id != TOKEN_IDENT)
-		{
-			cerr << "Runtime Error: Invalid structure for read node at line " << token.line << endl;
-			exit(1);
-		}
+parse::parse(compilation_context& context) : ctx(context), current_token(), tokens(nullptr), cursor(0),
+	speculative(false), failed(false), line_hint(0), string_indexed(0)
+{
+	next_token();
+}
+
+parse::parse(compilation_context& context, const token_stream& ts) : ctx(context), current_token(), tokens(&ts), cursor(0),
+	speculative(false), failed(false), line_hint(0), string_indexed(0)
+{
+	next_token();
+}
+parse::~parse()
+{
+}
 
-		int target_var_index = left->symbol_table_index;
+const node_arena& parse::get_arena() const
+{
+	return arena;
+}
 
-		if (target_var_index < 0 || target_var_index >= variable_values.size())
+void parse::next_token()
+{
+	if (tokens != nullptr)
+	{
+		if (cursor == tokens->error_index)
 		{
-			cerr << "Runtime Error: Invalid variable index (" << target_var_index << ") for read statement at line " << token.line << endl;
-			exit(1);
+			fatal("failed to read next token", current_token.line, current_token.col);
 		}
-
-		int read_value;
-		cin >> read_value;
-
-		if (cin.fail()) {
-			cerr << "\nRuntime Error: Invalid or missing integer input for read at line " << token.line << endl;
-			cin.clear();
-			cin.ignore(numeric_limits<streamsize>::max(), '\n');
-			exit(1);
+		current_token = speculative ? tokens->get(cursor, line_hint) : tokens->get(cursor);
+		if (current_token.id != TOKEN_EOF)
+		{
+			cursor++;
 		}
-		variable_values[target_var_index] = read_value;
-
-		return 0;
+		return;
 	}
 
-	if (token.id == TOKEN_INT4)
+	Token t;
+	Error e;
+	if (!lookahead.empty())
 	{
-		return 0;
+		t = lookahead.front().first;
+		e = lookahead.front().second;
+		lookahead.erase(lookahead.begin());
 	}
-
-	if (token.id == TOKEN_IF)
+	else
 	{
-		node* condition = left;
-		node* if_body = right;
-		node* else_body = next;
-
-		if (condition->evaluate() != 0)
-		{
-			return (if_body->token.id == TOKEN_BLOCK) ? evaluate_statement_list(if_body->left) : if_body->evaluate();
-		}
-		else if (else_body != nullptr)
-		{
-			return (else_body->token.id == TOKEN_BLOCK) ? evaluate_statement_list(else_body->left) : else_body->evaluate();
-		}
-		else {
-			return 0;
-		}
+		e = get_token(ctx.lex, t);
 	}
-
-	if (token.id == TOKEN_WHILE)
+	if (e.error != NCC_OK)
 	{
-		node* condition = left;
-		node* body = right;
-		int last_val = 0;
-		while (condition->evaluate() != 0)
-		{
-			last_val = (body->token.id == TOKEN_BLOCK) ? evaluate_statement_list(body->left) : body->evaluate();
-		}
-		return last_val;
+		fatal("failed to read next token", current_token.line, current_token.col);
 	}
-
-	if (token.id == TOKEN_BLOCK)
+	if (t.id == TOKEN_EOF)
 	{
-		return evaluate_statement_list(left);
+		current_token = t;
+		return;
 	}
+	current_token = t;
+}
 
-	cerr << "Runtime Error: Cannot evaluate node type: " << token.id << " ('" << token.val << "') at line " << token.line << endl;
-	exit(1);
-	return 0;
+const Token& parse::get_current_token()
+{
+	return current_token;
 }
 
-parse::parse()
+// Token-stream mode only: the stream index of the current token, and a
+// jump to continue parsing from another one.
+size_t parse::token_index() const
 {
-	next_token();
+	return current_token.id == TOKEN_EOF ? cursor : cursor - 1;
 }
-parse::~parse()
+
+void parse::seek(size_t index)
 {
+	cursor = index;
+	next_token();
 }
 
-void parse::next_token()
+token_id parse::peek(size_t ahead)
 {
-	Token t;
-	Error e = get_token(t);
-	if (e.error != NCC_OK)
+	if (ahead == 0)
 	{
-		error("failed to read next token", current_token.line, current_token.col);
+		return current_token.id;
 	}
-	if (t.id == TOKEN_EOF)
+	if (tokens != nullptr)
 	{
-		current_token = t;
-		return;
+		size_t i = cursor + ahead - 1;
+		if (i >= tokens->error_index)
+		{
+			return TOKEN_NULL;
+		}
+		return (token_id)tokens->kind[min(i, tokens->size() - 1)];
 	}
-	current_token = t;
-}
 
-Token parse::get_current_token()
-{
-	return current_token;
+	while (lookahead.size() < ahead)
+	{
+		Token t;
+		Error e = get_token(ctx.lex, t);
+		lookahead.push_back({ t, e });
+	}
+	const pair<Token, Error>& next = lookahead[ahead - 1];
+	return next.second.error == NCC_OK ? next.first.id : TOKEN_NULL;
 }
 
 void parse::consume(token_id id)
@@ -308,49 +211,231 @@ void parse::consume(token_id id)
 	}
 }
 
-void parse::error(const string& e, int line, int col)
+// Thrown by parse::error once the diagnostic is recorded, to abandon the
+// statement being parsed; parse_statement catches it and resynchronizes.
+struct parse_abort
 {
-	cerr << e << " at " << line << ":" << col << endl;
+};
 
-	string source_line;
-	if (get_src_line(line, source_line) == 0)
+// Records a diagnostic with its source line, while the line is still in
+// the source window.
+static void record_diagnostic(compilation_context& ctx, const string& e, int line, int col)
+{
+	diagnostic d = { e, line, col, string() };
+	get_src_line(ctx.lex.source, line, d.source_line);
+	ctx.diagnostics.push_back(move(d));
+}
+
+void report_diagnostics(const compilation_context& ctx)
+{
+	// get_src_line only reads the source, but keeps a line index cache.
+	source_buffer& source = const_cast<source_buffer&>(ctx.lex.source);
+	for (const diagnostic& d : ctx.diagnostics)
 	{
-		cerr << source_line << endl;
-		for (int i = 0; i < col - 1; ++i)
+		cerr << d.message << " at " << d.line << ":" << d.col << endl;
+
+		string source_line = d.source_line;
+		if (!source_line.empty() || get_src_line(source, d.line, source_line) == 0)
 		{
-			cerr << "-";
+			cerr << source_line << endl;
+			for (int i = 0; i < d.col - 1; ++i)
+			{
+				cerr << "-";
+			}
+			cerr << "^" << endl;
+		}
+		else {
+			cerr << "Could not retrieve source line" << endl;
 		}
-		cerr << "^" << endl;
 	}
-	else {
-		cerr << "Could not retrieve source line" << endl;
+	if (ctx.max_errors != 0 && ctx.diagnostics.size() >= ctx.max_errors)
+	{
+		cerr << "Stopped after " << ctx.diagnostics.size() << " errors" << endl;
+	}
+}
+
+// Records an error the parser can continue from where it is.
+void parse::report(const string& e, int line, int col)
+{
+	if (speculative)
+	{
+		failed = true;
+		return;
+	}
+	record_diagnostic(ctx, e, line, col);
+	if (ctx.max_errors != 0 && ctx.diagnostics.size() >= ctx.max_errors)
+	{
+		report_diagnostics(ctx);
+		exit(1);
 	}
+}
+
+// Records an error and abandons the current statement.
+void parse::error(const string& e, int line, int col)
+{
+	report(e, line, col);
+	throw parse_abort();
+}
+
+// Records an error nothing can be parsed past, such as a bad token, and
+// reports everything so far.
+void parse::fatal(const string& e, int line, int col)
+{
+	record_diagnostic(ctx, e, line, col);
+	report_diagnostics(ctx);
 	exit(1);
 }
 
-node* parse::parse_expression()
+// Panic-mode recovery after an error in the statement that began at
+// offset start. Skips to just past a ';' or a complete {...} group (and
+// any else that follows it), or to a '}' or statement keyword, counting
+// only those outside braces the statement itself opened. A token the
+// statement began with is always skipped, so every retry makes progress.
+void parse::synchronize(size_t start)
 {
-	return parse_logical_or_expression();
+	int depth = 0;
+	for (bool first = current_token.offset == start; current_token.id != TOKEN_EOF; first = false)
+	{
+		switch (current_token.id)
+		{
+		case TOKEN_LBRACE:
+			depth++;
+			break;
+		case TOKEN_RBRACE:
+			if (depth == 0 && !first)
+			{
+				return;
+			}
+			if (depth > 0 && --depth == 0)
+			{
+				next_token();
+				if (current_token.id != TOKEN_ELSE)
+				{
+					return;
+				}
+			}
+			break;
+		case TOKEN_SEMICOLON:
+			if (depth == 0)
+			{
+				next_token();
+				return;
+			}
+			break;
+		case TOKEN_PRINT:
+		case TOKEN_READ:
+		case TOKEN_INT4:
+		case TOKEN_IF:
+		case TOKEN_WHILE:
+			if (depth == 0 && !first)
+			{
+				return;
+			}
+			break;
+		default:
+			break;
+		}
+		next_token();
+	}
 }
 
+// Every binary operator has a binding power; its right operand is parsed
+// at the next power up, so all of them are left associative unless the
+// rule says otherwise. Adding an operator takes a row here and, if it
+// brings a new power, a type rule in make_binary.
+struct infix_rule
+{
+	binding_power power;
+	bool right_assoc;
+};
 
-node* parse::parse_term()
+static const array<infix_rule, TOKEN_FALSE + 1> infix_rules = []
+{
+	array<infix_rule, TOKEN_FALSE + 1> rules{};
+	rules[TOKEN_OR] = { bp_or, false };
+	rules[TOKEN_AND] = { bp_and, false };
+	rules[TOKEN_LESS] = { bp_relational, false };
+	rules[TOKEN_LESS_EQ] = { bp_relational, false };
+	rules[TOKEN_GREATER] = { bp_relational, false };
+	rules[TOKEN_GREATER_EQ] = { bp_relational, false };
+	rules[TOKEN_EQUAL] = { bp_relational, false };
+	rules[TOKEN_NOT_EQUAL] = { bp_relational, false };
+	rules[TOKEN_PLUS] = { bp_additive, false };
+	rules[TOKEN_MINUS] = { bp_additive, false };
+	rules[TOKEN_MULT] = { bp_multiplicative, false };
+	rules[TOKEN_DIV] = { bp_multiplicative, false };
+	rules[TOKEN_MOD] = { bp_multiplicative, false };
+	return rules;
+}();
+
+// Parses an expression whose operators all bind at least as tightly as
+// min_power. '!' is a prefix at bp_not, so it may start an operand of '&'
+// or '|' but not of a relational or arithmetic operator.
+node* parse::parse_expression(int min_power)
 {
-	node* this_node = parse_factor();
+	node* left_node;
+	if (current_token.id == TOKEN_NOT && min_power <= bp_not)
+	{
+		Token op = current_token;
+		consume(TOKEN_NOT);
+		node* operand = parse_expression(bp_not);
+		if (operand->val_type != vt_bool)
+		{
+			error("Operand for '!' must be boolean", op.line, op.col);
+		}
+		left_node = arena.make(op, operand, nullptr);
+		left_node->val_type = vt_bool;
+	}
+	else
+	{
+		left_node = parse_factor();
+	}
 
-	while (current_token.id == TOKEN_MULT || current_token.id == TOKEN_DIV || current_token.id == TOKEN_MOD)
+	for (;;)
 	{
+		const infix_rule& rule = infix_rules[current_token.id];
+		if (rule.power == bp_none || rule.power < min_power)
+		{
+			break;
+		}
 		Token op = current_token;
 		consume(op.id);
-		node* right = parse_factor();
-		if (this_node->val_type != vt_int4 || right->val_type != vt_int4)
+		node* right_node = parse_expression(rule.right_assoc ? rule.power : rule.power + 1);
+		left_node = make_binary(op, left_node, right_node);
+	}
+	return left_node;
+}
+
+node* parse::make_binary(const Token& op, node* left_node, node* right_node)
+{
+	node* this_node = arena.make(op, left_node, right_node);
+	switch (infix_rules[op.id].power)
+	{
+	case bp_or:
+	case bp_and:
+		if (left_node->val_type != vt_bool || right_node->val_type != vt_bool)
 		{
-			error(op.val + "' must be int4", op.line, op.col);
+			error(op.id == TOKEN_OR ? "Operands for '|' must be boolean" : "Operands for '&' must be boolean", op.line, op.col);
+		}
+		this_node->val_type = vt_bool;
+		break;
+	case bp_relational:
+		if (left_node->val_type != vt_int4 || right_node->val_type != vt_int4)
+		{
+			error("Operands for relational operator '" + string(op.val) + "' must be int4", op.line, op.col);
+		}
+		this_node->val_type = vt_bool;
+		break;
+	case bp_additive:
+		this_node->val_type = (left_node->val_type == vt_int4 && right_node->val_type == vt_int4) ? vt_int4 : vt_null;
+		break;
+	default:
+		if (left_node->val_type != vt_int4 || right_node->val_type != vt_int4)
+		{
+			error(string(op.val) + "' must be int4", op.line, op.col);
 		}
-
-		this_node = new node(op, this_node, right);
 		this_node->val_type = vt_int4;
-
+		break;
 	}
 	return this_node;
 }
@@ -389,41 +474,62 @@ node* parse::parse_factor()
 			error("Operand for '-' must be int4", op.line, op.col);
 		}
 
-		this_node = new node(op, nullptr, operand);
+		this_node = arena.make(op, nullptr, operand);
 		this_node->val_type = vt_int4;
 	}
 	else if (current_token.id == TOKEN_INTEGER)
 	{
-		this_node = new node(current_token);
+		this_node = arena.make(current_token);
+		string_view digits = current_token.val;
+		if (from_chars(digits.data(), digits.data() + digits.size(), this_node->value).ec != errc())
+		{
+			report("Integer literal '" + string(digits) + "' out of range", current_token.line, current_token.col);
+		}
 		consume(current_token.id);
 		this_node->val_type = vt_int4;
 	}
 	else if (current_token.id == TOKEN_STRING) 
 	{
-		this_node = new node(current_token);
+		this_node = arena.make(current_token);
+		if (speculative)
+		{
+			string_refs.push_back(this_node);
+		}
+		else
+		{
+			this_node->value = string_id(current_token.val);
+		}
 		consume(current_token.id);
 		this_node->val_type = vt_string;
 	}
 	else if (current_token.id == TOKEN_TRUE || current_token.id == TOKEN_FALSE)
 	{
-		this_node = new node(current_token);
+		this_node = arena.make(current_token);
 		consume(current_token.id);
 		this_node->val_type = vt_bool;
 	}
 	else if (current_token.id == TOKEN_IDENT) 
 	{
-		this_node = new node(current_token);
-		string var_name = current_token.val;
-		int symbol_index = find(var_name);
-		if (symbol_index == -1)
+		this_node = arena.make(current_token);
+		string_view var_name = current_token.val;
+		int symbol_index = speculative ? -1 : find(ctx.sym_table, var_name);
+		if (speculative)
+		{
+			symbol_refs.push_back({ this_node, false });
+		}
+		else if (symbol_index == -1)
 		{
-			error("Undeclared variable '" + var_name + "'", current_token.line, current_token.col);
+			error("Undeclared variable '" + string(var_name) + "'", current_token.line, current_token.col);
 		}
 		this_node->symbol_table_index = symbol_index;
 
-		if (symbol_index != -1)
+		if (speculative)
 		{
-			this_node->val_type = sym_table[symbol_index].val_type;
+			this_node->val_type = vt_int4;
+		}
+		else if (symbol_index != -1)
+		{
+			this_node->val_type = ctx.sym_table[symbol_index].val_type;
 		}
 		else
 		{
@@ -439,45 +545,46 @@ node* parse::parse_factor()
 	}
 	else
 	{
-		error("Unexpected token '" + current_token.val + "' encountered while parsing factor", current_token.line, current_token.col);
+		error("Unexpected token '" + string(current_token.val) + "' encountered while parsing factor", current_token.line, current_token.col);
 		return nullptr;
 	}
 
 	return this_node;
 }
 
-node* parse::parse_arithmetic_expression()
+// Drops the string_table ids looked up so far, for an owner that has
+// renumbered the table.
+void parse::forget_strings()
 {
-	node* this_node = parse_term();
+	string_ids.clear();
+	string_indexed = 0;
+}
 
-	while (current_token.id == TOKEN_PLUS || current_token.id == TOKEN_MINUS)
+// The id of text in ctx.string_table, adding it if it is new. Other
+// parsers may have added strings since the last call; they are indexed
+// first, so equal strings always share the earliest id.
+int parse::string_id(string_view text)
+{
+	for (; string_indexed < ctx.string_table.size(); string_indexed++)
 	{
-		Token op = current_token;
-		consume(op.id);
-		node* right = parse_term();
-
-		this_node = new node(op, this_node, right);
-
-		if (this_node->left->val_type == vt_int4 && this_node->right->val_type == vt_int4)
-		{
-			this_node->val_type = vt_int4;
-		}
-		else {
-			this_node->val_type = vt_null;
-		}
+		string_ids.emplace(ctx.string_table[string_indexed], (int)string_indexed);
 	}
-	return this_node;
+	auto found = string_ids.emplace(string(text), (int)ctx.string_table.size());
+	if (found.second)
+	{
+		ctx.string_table.emplace_back(text);
+		string_indexed++;
+	}
+	return found.first->second;
 }
 
 node* parse::parse_print_statement()
 {
+	Token print_token = current_token;
 	consume(TOKEN_PRINT);
 	consume(TOKEN_LPAREN);
 
-	Token print_token;
-	print_token.id = TOKEN_PRINT;
-	print_token.val = "print";
-	node* print_node = new node(print_token, nullptr, nullptr);
+	node* print_node = arena.make(print_token, nullptr, nullptr);
 
 	node* first_expr = parse_expression();
 	print_node->left = first_expr;
@@ -518,30 +625,34 @@ node* parse::parse_read_statement()
 	}
 
 	Token ident_token = current_token;
-	string var_name = ident_token.val;
-	int symbol_index = find(var_name);
+	string_view var_name = ident_token.val;
+	int symbol_index = speculative ? -1 : find(ctx.sym_table, var_name);
 
-	if (symbol_index == -1)
+	if (!speculative && symbol_index == -1)
 	{
-		error("Undeclared variable '" + var_name + "' used in read statement.", ident_token.line, ident_token.col);
+		error("Undeclared variable '" + string(var_name) + "' used in read statement.", ident_token.line, ident_token.col);
 		return nullptr;
 	}
 
-	if (sym_table[symbol_index].val_type != vt_int4) {
-		error("Variable '" + var_name + "' in read statement not int4.", ident_token.line, ident_token.col);
+	if (!speculative && ctx.sym_table[symbol_index].val_type != vt_int4) {
+		error("Variable '" + string(var_name) + "' in read statement not int4.", ident_token.line, ident_token.col);
 		return nullptr;
 	}
 
-	node* var_node = new node(ident_token);
+	node* var_node = arena.make(ident_token);
 	var_node->symbol_table_index = symbol_index;
 	var_node->val_type = vt_int4;
+	if (speculative)
+	{
+		symbol_refs.push_back({ var_node, false });
+	}
 
 
 	consume(TOKEN_IDENT);
 	consume(TOKEN_RPAREN);
 	consume(TOKEN_SEMICOLON);
 
-	node* read_node = new node(read_token, var_node, nullptr);
+	node* read_node = arena.make(read_token, var_node, nullptr);
 	read_node->val_type = vt_null;
 
 	return read_node;
@@ -554,13 +665,17 @@ node* parse::parse_assignment_statement()
 		error("Assignment statement must begin with identifier.", current_token.line, current_token.col);
 	}
 
-	node* var_node = new node(current_token);
-	string var_name = current_token.val;
-	int symbol_index = find(var_name);
+	node* var_node = arena.make(current_token);
+	string_view var_name = current_token.val;
+	int symbol_index = speculative ? -1 : find(ctx.sym_table, var_name);
 
-	if (symbol_index == -1)
+	if (speculative)
 	{
-		error("Undeclared variable '" + var_name + "'.", current_token.line, current_token.col);
+		symbol_refs.push_back({ var_node, false });
+	}
+	else if (symbol_index == -1)
+	{
+		report("Undeclared variable '" + string(var_name) + "'.", current_token.line, current_token.col);
 	}
 	var_node->symbol_table_index = symbol_index;
 	consume(TOKEN_IDENT);
@@ -582,7 +697,7 @@ node* parse::parse_assignment_statement()
 	}
 	consume(TOKEN_SEMICOLON);
 
-	node* assign_node = new node(assignToken, var_node, expr_node);
+	node* assign_node = arena.make(assignToken, var_node, expr_node);
 
 	return assign_node;
 }
@@ -592,100 +707,52 @@ node* parse::parse_decl_statement()
 	Token decl_token = current_token;
 	consume(TOKEN_INT4);
 	Token ident_token = current_token;
-	string var_name = current_token.val;
+	string_view var_name = current_token.val;
 	consume(TOKEN_IDENT);
 	consume(TOKEN_SEMICOLON);
 
-	if (find(var_name) != -1)
-	{
-		error("Duplicate symbol: " + var_name, ident_token.line, ident_token.col);
-	}
-	else
+	node* var_node = arena.make(ident_token);
+	if (speculative)
 	{
-		insert(var_name, symbol_var, vt_int4);
+		symbol_refs.push_back({ var_node, true });
+		return arena.make(decl_token, var_node, nullptr);
 	}
 
-	node* var_node = new node(ident_token);
-	var_node->symbol_table_index = find(var_name);
-	node* decl_node = new node(decl_token, var_node, nullptr);
-
-	return decl_node;
-}
-
-node* parse::parse_relational_expression()
-{
-	node* left_node = parse_arithmetic_expression();
-
-	while (current_token.id == TOKEN_LESS || current_token.id == TOKEN_LESS_EQ || current_token.id == TOKEN_GREATER || current_token.id == TOKEN_GREATER_EQ || current_token.id == TOKEN_EQUAL || current_token.id == TOKEN_NOT_EQUAL)
+	if (find(ctx.sym_table, var_name) != -1)
 	{
-		Token op = current_token;
-		consume(op.id);
-		node* right_node = parse_arithmetic_expression();
-		if (left_node->val_type != vt_int4 || right_node->val_type != vt_int4)
-		{
-			error("Operands for relational operator '" + op.val + "' must be int4", op.line, op.col);
-		}
-		left_node = new node(op, left_node, right_node);
-		left_node->val_type = vt_bool;
+		report("Duplicate symbol: " + string(var_name), ident_token.line, ident_token.col);
 	}
-	return left_node;
-}
-
-node* parse::parse_logical_or_expression()
-{
-	node* left_node = parse_logical_and_expression();
-	while (current_token.id == TOKEN_OR)
+	else
 	{
-		Token op = current_token;
-		consume(TOKEN_OR);
-		node* right_node = parse_logical_and_expression();
-		if (left_node->val_type != vt_bool || right_node->val_type != vt_bool)
-		{
-			error("Operands for '|' must be boolean", op.line, op.col);
-		}
-		left_node = new node(op, left_node, right_node);
-		left_node->val_type = vt_bool;
+		insert(ctx.sym_table, var_name, symbol_var, vt_int4);
 	}
-	return left_node;
+	var_node->symbol_table_index = find(ctx.sym_table, var_name);
+	node* decl_node = arena.make(decl_token, var_node, nullptr);
+
+	return decl_node;
 }
 
-node* parse::parse_logical_and_expression()
+// Parses one statement. After a syntax or type error it skips ahead (see
+// synchronize) and returns a TOKEN_NULL placeholder, so callers only see
+// nullptr for an empty statement.
+node* parse::parse_statement()
 {
-	node* left_node = parse_logical_not_expression();
-	while (current_token.id == TOKEN_AND)
+	size_t start = current_token.offset;
+	try
 	{
-		Token op = current_token;
-		consume(TOKEN_AND);
-		node* right_node = parse_logical_not_expression();
-		if (left_node->val_type != vt_bool || right_node->val_type != vt_bool)
-		{
-			error("Operands for '&' must be boolean", op.line, op.col);
-		}
-		left_node = new node(op, left_node, right_node);
-		left_node->val_type = vt_bool;
+		return parse_statement_kind();
 	}
-	return left_node;
-}
-
-node* parse::parse_logical_not_expression()
-{
-	if (current_token.id == TOKEN_NOT)
+	catch (const parse_abort&)
 	{
-		Token op = current_token;
-		consume(TOKEN_NOT);
-		node* operand = parse_logical_not_expression();
-		if (operand->val_type != vt_bool)
-		{
-			error("Operand for '!' must be boolean", op.line, op.col);
-		}
-		node* not_node = new node(op, operand, nullptr);
-		not_node->val_type = vt_bool;
-		return not_node;
+		synchronize(start);
 	}
-	return parse_relational_expression();
+	Token error_token = current_token;
+	error_token.id = TOKEN_NULL;
+	error_token.val = "<error>";
+	return arena.make(error_token);
 }
 
-node* parse::parse_statement()
+node* parse::parse_statement_kind()
 {
 	switch (current_token.id)
 	{
@@ -716,7 +783,7 @@ node* parse::parse_statement()
 		return nullptr;
 
 	default:
-		error("Unexpected token '" + current_token.val + "' - Expected statement start", current_token.line, current_token.col);
+		error("Unexpected token '" + string(current_token.val) + "' - Expected statement start", current_token.line, current_token.col);
 		return nullptr;
 	}
 }
@@ -746,7 +813,7 @@ node* parse::parse_if_statement()
 		}
 	}
 
-	node* if_node = new node(if_token, condition, if_body);
+	node* if_node = arena.make(if_token, condition, if_body);
 	if (else_body)
 	{
 		if_node->next = else_body;
@@ -784,12 +851,11 @@ node* parse::parse_statement_or_block()
 				statement_list_tail->next = nullptr;
 			}
 			else {
-				error("Expected statement or '}' inside block", current_token.line, current_token.col);
-				break;
+				report("Expected statement or '}' inside block", current_token.line, current_token.col);
 			}
 		}
 		consume(TOKEN_RBRACE);
-		node* block_node = new node(block_token);
+		node* block_node = arena.make(block_token);
 		block_node->left = statement_list_head;
 		block_node->val_type = vt_null;
 		return block_node;
@@ -808,339 +874,179 @@ node* parse::parse_while_statement()
 	node* condition = parse_expression();
 	if (condition->val_type != vt_bool)
 	{
-		error("While condition must be a boolean", while_token.line, while_token.col);
+		report("While condition must be a boolean", while_token.line, while_token.col);
 	}
 
 	consume(TOKEN_RPAREN);
 	node* body = parse_statement_or_block();
 
-	node* while_node = new node(while_token, condition, body);
+	node* while_node = arena.make(while_token, condition, body);
 	while_node->val_type = vt_null;
 	return while_node;
 }
 
 void print_tree(node* root, int space)
 {
-	if (root == nullptr)
-	{
-		return;
-	}
+	walk_print(tree_view(), root, space);
+}
 
-	for (int i = 0; i < space; i++)
+// One run of top-level statements for parse_parallel: tokens [begin, end).
+struct parse_chunk
+{
+	size_t begin;
+	size_t end;
+	vector<node*> statements;
+};
+
+static const size_t parallel_min_tokens = 64 * 1024;
+
+// Parses the top-level statements of tokens on several threads, each chunk
+// into its own parser (and so its own arena), which end up in parsers.
+// Chunks end after a ';' or '}' outside braces that no else follows, where
+// a top-level statement must end if the program is valid. Symbols are then
+// declared and looked up in program order, on this thread. Returns false,
+// having changed nothing, for a program that is small or does not parse
+// cleanly this way; the caller parses it serially, which reports the errors
+// exactly as usual.
+bool parse_parallel(compilation_context& ctx, const token_stream& tokens, unsigned threads,
+	vector<unique_ptr<parse>>& parsers, vector<node*>& program_statements)
+{
+	size_t size = tokens.size();
+	if (threads < 2 || tokens.error.error != NCC_OK || size < 2 * parallel_min_tokens)
 	{
-		cout << " ";
+		return false;
 	}
 
-	if (root->token.id == TOKEN_PRINT)
-	{
-		cout << "print" << endl;
-		node* current_arg = root->left;
-		while (current_arg != nullptr)
-		{
-			print_tree(current_arg, space + 2);
-			current_arg = current_arg->next;
-		}
-		return;
-	}
-	else if (root->token.id == TOKEN_IF)
-	{
-		cout << "if" << endl;
-		if (root->left)
-		{
-			print_tree(root->left, space + 2);
-		}
-		if (root->right)
-		{
-			print_tree(root->right, space + 2);
-		}
-		if (root->next)
-		{
-			for (int i = 0; i < space; i++)
-			{
-				cout << " ";
-		}
-			cout << "else" << endl;
-			print_tree(root->next, space + 2);
-		}
-		return;
-	}
-	else if (root->token.id == TOKEN_WHILE)
-	{
-		cout << "while" << endl;
-		if (root->left)
-		{
-			print_tree(root->left, space + 2);
-		}
-		if (root->right)
-		{
-			print_tree(root->right, space + 2);
-		}
-		return;
-	}
-	else if (root->token.id == TOKEN_BLOCK)
-	{
-		cout << "{ Block }" << endl;
-		node* current_statement = root->left;
-		while (current_statement != nullptr)
-		{
-			print_tree(current_statement, space + 2);
-			current_statement = current_statement->next;
-		}
-		return;
-	}
-	else if (root->token.id == TOKEN_READ)
-	{
-		cout << "read" << endl;
-		if (root->left)
-		{
-			print_tree(root->left, space + 2);
-		}
-		return;
-	}
-	else if (root->token.id == TOKEN_ASSIGN)
+	size_t count = min<size_t>((size_t)threads * 4, size / parallel_min_tokens);
+	vector<parse_chunk> chunks;
+	size_t begin = 0;
+	int depth = 0;
+	for (size_t i = 0; i + 1 < size && chunks.size() + 1 < count; i++)
 	{
-		cout << "<-" << endl;
-		if (root->left)
+		token_id id = (token_id)tokens.kind[i];
+		if (id == TOKEN_LBRACE)
 		{
-			print_tree(root->left, space + 2);
+			depth++;
 		}
-		if (root->right)
+		else if (id == TOKEN_RBRACE && depth > 0)
 		{
-			print_tree(root->right, space + 2);
+			depth--;
 		}
-		return;
-	}
-	else if (root->token.id == TOKEN_READ)
-	{
-		cout << "read" << endl;
-		if (root->left) 
+		if ((id == TOKEN_SEMICOLON || id == TOKEN_RBRACE) && depth == 0 && tokens.kind[i + 1] != TOKEN_ELSE
+			&& i + 1 >= size * (chunks.size() + 1) / count)
 		{
-			print_tree(root->left, space + 2);
+			chunks.push_back({ begin, i + 1, {} });
+			begin = i + 1;
 		}
-		return;
 	}
-	else if (root->token.id == TOKEN_PLUS)
+	if (chunks.empty())
 	{
-		cout << "+ (add)" << endl;
-		if (root->left)
-		{
-			print_tree(root->left, space + 2);
-		}
-		if (root->right)
-		{
-			print_tree(root->right, space + 2);
-		}
-		return;
+		return false;
 	}
-	else if (root->token.id == TOKEN_MINUS)
-	{
-		if (root->left == nullptr && root->right != nullptr)
-		{
-			cout << "- (neg)" << endl;
-			print_tree(root->right, space + 2);
-		}
-		else
-		{
-			cout << "- (sub)" << endl;
-			print_tree(root->left, space + 2);
-			print_tree(root->right, space + 2);
-		}
-		return;
-	}
-	else if (root->token.id == TOKEN_MULT)
-	{
-		cout << "* (mult)" << endl;
-		if (root->left)
-		{
-			print_tree(root->left, space + 2);
-		}
-		if (root->right)
-		{
-			print_tree(root->right, space + 2);
-		}
-		return;
-	}
-	else if (root->token.id == TOKEN_DIV)
-	{
-		cout << "/ (div)" << endl;
-		if (root->left)
-		{
-			print_tree(root->left, space + 2);
-		}
-		if (root->right)
-		{
-			print_tree(root->right, space + 2);
-		}
-		return;
-	}
-	else if (root->token.id == TOKEN_MOD)
-	{
-		cout << "mod" << endl;
-		if (root->left)
-		{
-			print_tree(root->left, space + 2);
-		}
-		if (root->right)
-		{
-			print_tree(root->right, space + 2);
-		}
-		return;
-	}
-	else if (root->token.id == TOKEN_LESS)
-	{
-		cout << "<" << endl; if (root->left)
-		{
-			print_tree(root->left, space + 2);
-		} 
-		if (root->right)
-		{
-			print_tree(root->right, space + 2);
-		} 
-		return;
-}
-	else if (root->token.id == TOKEN_LESS_EQ)
-	{
-		cout << "<=" << endl;
-		if (root->left)
-		{
-			print_tree(root->left, space + 2);
-		}
-		if (root->right)
-		{
-			print_tree(root->right, space + 2);
-		}
-		return;
-	}
-	else if (root->token.id == TOKEN_GREATER)
+	chunks.push_back({ begin, size, {} });
+
+	// The constructors read the first token of each chunk, so they run
+	// here; the line index is complete once the first one has.
+	vector<unique_ptr<parse>> chunk_parsers;
+	for (parse_chunk& c : chunks)
 	{
-		cout << ">" << endl;
-		if (root->left)
-		{
-			print_tree(root->left, space + 2);
-		}
-		if (root->right)
-		{
-			print_tree(root->right, space + 2);
-		}
-		return;
+		chunk_parsers.push_back(make_unique<parse>(ctx, tokens));
+		parse& p = *chunk_parsers.back();
+		p.speculative = true;
+		p.seek(c.begin);
 	}
-	else if (root->token.id == TOKEN_GREATER_EQ)
+
+	atomic<size_t> next_chunk(0);
+	auto worker = [&]()
 	{
-		cout << ">=" << endl;
-		if (root->left)
-		{
-			print_tree(root->left, space + 2);
-		}
-		if (root->right)
+		size_t i;
+		while ((i = next_chunk++) < chunks.size())
 		{
-			print_tree(root->right, space + 2);
+			parse& p = *chunk_parsers[i];
+			while (!p.failed && p.current_token.id != TOKEN_EOF && p.token_index() < chunks[i].end)
+			{
+				node* statement_root = p.parse_statement();
+				if (statement_root != nullptr)
+				{
+					chunks[i].statements.push_back(statement_root);
+				}
+				else if (p.current_token.id != TOKEN_EOF)
+				{
+					p.failed = true;
+				}
+			}
 		}
-		return;
-	}
-	else if (root->token.id == TOKEN_EQUAL)
+	};
+	vector<thread> pool;
+	for (unsigned i = 1; i < threads && i < chunks.size(); i++)
 	{
-		cout << "=" << endl;
-		if (root->left)
-		{
-			print_tree(root->left, space + 2);
-		}
-		if (root->right)
-		{
-			print_tree(root->right, space + 2);
-		}
-		return;
+		pool.emplace_back(worker);
 	}
-	else if (root->token.id == TOKEN_NOT_EQUAL)
+	worker();
+	for (thread& th : pool)
 	{
-		cout << "~=" << endl;
-		if (root->left)
-		{
-			print_tree(root->left, space + 2);
-		}
-		if (root->right)
-		{
-			print_tree(root->right, space + 2);
-		}
-		return;
+		th.join();
 	}
-	else if (root->token.id == TOKEN_AND)
+
+	for (size_t i = 0; i < chunks.size(); i++)
 	{
-		cout << "&" << endl;
-		if (root->left)
-		{
-			print_tree(root->left, space + 2);
-		}
-		if (root->right)
+		const parse& p = *chunk_parsers[i];
+		if (p.failed || p.token_index() != min(chunks[i].end, size - 1))
 		{
-			print_tree(root->right, space + 2);
+			return false;
 		}
-		return;
 	}
-	else if (root->token.id == TOKEN_OR)
+
+	// A valid program declares each name once, before any use, so a map
+	// stands in for find as the table grows. The table is reserved so the
+	// names the map points into stay put.
+	size_t sym_begin = ctx.sym_table.size();
+	size_t declared = 0;
+	for (const unique_ptr<parse>& p : chunk_parsers)
 	{
-		cout << "|" << endl;
-		if (root->left)
-		{
-			print_tree(root->left, space + 2);
-		}
-		if (root->right)
+		for (const parse::symbol_ref& ref : p->symbol_refs)
 		{
-			print_tree(root->right, space + 2);
+			declared += ref.declares;
 		}
-		return;
 	}
-	else if (root->token.id == TOKEN_NOT)
+	ctx.sym_table.reserve(sym_begin + declared);
+	unordered_map<string_view, int> symbols;
+	for (size_t i = 0; i < sym_begin; i++)
 	{
-		cout << "!" << endl;
-		if (root->left)
-		{
-			print_tree(root->left, space + 2);
-		}
-		return;
+		symbols.emplace(ctx.sym_table[i].name, (int)i);
 	}
-	else if (root->token.id == TOKEN_INT4)
-	{
-		if (root->left && root->left->token.id == TOKEN_IDENT)
-		{
-			cout << "  variable: " << root->left->token.val << endl;
-		}
-		else
-		{
-			cout << "int4 declaration (unexpected structure)" << endl;
-		}
-		return;
-		}
+	for (const unique_ptr<parse>& p : chunk_parsers)
 	{
-		if (root->token.id == TOKEN_TRUE)
-		{
-			cout << "true" << endl;
-		}
-		else if (root->token.id == TOKEN_FALSE)
+		for (const parse::symbol_ref& ref : p->symbol_refs)
 		{
-			cout << "false" << endl;
-		}
-		else if (root->token.id == TOKEN_STRING)
-		{
-			if (root->token.val == "\n")
+			string_view name = ref.n->token.val;
+			auto found = symbols.find(name);
+			if (ref.declares == (found != symbols.end()))
 			{
-				cout << endl;
+				ctx.sym_table.resize(sym_begin);
+				return false;
 			}
-			else
+			if (ref.declares)
 			{
-				cout << root->token.val << endl;
+				found = symbols.emplace(name, insert(ctx.sym_table, name, symbol_var, vt_int4)).first;
 			}
+			ref.n->symbol_table_index = found->second;
 		}
-		else if (root->token.id == TOKEN_IDENT)
-		{
-			cout <<  "variable: " << root->token.val << endl;
-		}
-		else if (root->token.id == TOKEN_INTEGER)
-		{
-			cout << root->token.val << endl;
-		}
-		else
+	}
+
+	for (const unique_ptr<parse>& p : chunk_parsers)
+	{
+		for (node* n : p->string_refs)
 		{
-			cout << root->token.val << " (token: " << root->token.id << ")" << endl;
+			n->value = chunk_parsers.front()->string_id(n->token.val);
 		}
 	}
-}
\ No newline at end of file
+
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		program_statements.insert(program_statements.end(), chunks[i].statements.begin(), chunks[i].statements.end());
+		chunk_parsers[i]->speculative = false;
+		parsers.push_back(move(chunk_parsers[i]));
+	}
+	return true;
+}
@@ -3,6 +3,7 @@
 
 #include "lex.h"
 #include "s_table.h"
+#include "context.h"
 
 #include <string>
 #include <iostream>
@@ -11,6 +12,10 @@
 #include <stdexcept>
 #include <limits>
 #include <map>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
 
 class node
 {
@@ -21,31 +26,67 @@ public:
 	node* next;
 	value_type val_type;
 	int symbol_table_index;
+	// Decoded once by the parser: the value of an integer literal or the
+	// string_table id of a string literal.
+	int value;
 
 	node(const Token& t);
 	node(const Token& t, node* l, node* r);
-	~node();
 
-	int evaluate() const;
+	int evaluate(compilation_context& ctx) const;
+};
+
+// Bump allocator for the nodes of one parse. Nodes are never freed one by
+// one; the whole tree goes away with the arena.
+class node_arena
+{
+public:
+	node_arena();
+	node* make(const Token& t);
+	node* make(const Token& t, node* l, node* r);
+
+	size_t node_count() const;
+	size_t bytes_used() const;
+	size_t bytes_reserved() const;
+
+private:
+	vector<unique_ptr<char[]>> blocks;
+	char* cursor;
+	size_t left;
+	size_t count;
+	size_t reserved;
+	node* allocate();
+};
+
+// Binding powers of the expression grammar, loosest first.
+enum binding_power
+{
+	bp_none,
+	bp_or,
+	bp_and,
+	bp_not,
+	bp_relational,
+	bp_additive,
+	bp_multiplicative
 };
 
 class parse
 {
 public:
-	parse();
+	parse(compilation_context& context);
+	parse(compilation_context& context, const token_stream& tokens);
 	~parse();
-	node* parse_expression();
-	node* parse_term();
+	node* parse_expression(int min_power = bp_or);
 	node* parse_factor();
-	node* parse_arithmetic_expression();
-	node* parse_relational_expression();
-	node* parse_logical_or_expression();
-	node* parse_logical_and_expression();
-	node* parse_logical_not_expression();
 	node* parse_if_statement();
 	node* parse_statement_or_block();
 	node* parse_while_statement();
-	Token get_current_token();
+	const Token& get_current_token();
+	const node_arena& get_arena() const;
+	token_id peek(size_t ahead);
+	size_t token_index() const;
+	void seek(size_t index);
+	void forget_strings();
 
 	node* parse_statement();
 	node* parse_print_statement();
@@ -54,16 +95,53 @@ public:
 	node* parse_decl_statement();
 
 	void error(const string& e, int line, int col);
+	void report(const string& e, int line, int col);
+
+	friend bool parse_parallel(compilation_context& ctx, const token_stream& tokens, unsigned threads,
+		vector<unique_ptr<parse>>& parsers, vector<node*>& program_statements);
 
 private:
+	compilation_context& ctx;
+	node_arena arena;
 	Token current_token;
+	const token_stream* tokens;
+	size_t cursor;
+	vector<pair<Token, Error>> lookahead;
+
+	// Set on the chunk parsers of parse_parallel, which share the token
+	// stream between threads. They leave ctx alone: every identifier is
+	// taken as an int4 and noted in symbol_refs (declares is true for a
+	// declaration) to be looked up afterwards, and an error only sets failed.
+	struct symbol_ref
+	{
+		node* n;
+		bool declares;
+	};
+	bool speculative;
+	bool failed;
+	size_t line_hint;
+	vector<symbol_ref> symbol_refs;
+	vector<node*> string_refs;
+
+	// string_table ids by text; entries from string_indexed on are not in
+	// string_ids yet.
+	unordered_map<string, int> string_ids;
+	size_t string_indexed;
+	int string_id(string_view text);
+
 	void next_token();
 	void consume(token_id id);
+	void fatal(const string& e, int line, int col);
+	void synchronize(size_t start);
+	node* parse_statement_kind();
+	node* make_binary(const Token& op, node* left_node, node* right_node);
 };
 
-extern vector<int> variable_values;
-
 void print_tree(node* root, int space = 0);
-int evaluate_statement_list(const node* stmt_head);
+int evaluate_statement_list(compilation_context& ctx, const node* stmt_head);
+bool verify_program(compilation_context& ctx, const vector<node*>& program_statements);
+void report_diagnostics(const compilation_context& ctx);
+bool parse_parallel(compilation_context& ctx, const token_stream& tokens, unsigned threads,
+	vector<unique_ptr<parse>>& parsers, vector<node*>& program_statements);
 
 #endif
\ No newline at end of file
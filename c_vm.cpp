@@ -0,0 +1,691 @@
+#include "c_vm.h"
+#include "c_walk.h"
+
+#include <algorithm>
+#include <initializer_list>
+#include <iostream>
+#include <unordered_map>
+
+// Arithmetic and comparisons come in three forms: X pops both operands, X_K
+// takes the right one from a and X_V from variable slot a. The JN* forms
+// are a comparison fused with the jump after it: they pop the left operand
+// (and the right, for the stack form) and jump to b unless it holds. The
+// comparisons and their jumps keep the same order, so one maps onto the
+// other by offset.
+#define VM_OPCODES(X) \
+	X(HALT) X(FAIL) X(CALL) X(RET) X(JUMP) X(JUMP_IF_FALSE) X(JUMP_IF_TRUE) X(AND_JUMP) X(OR_JUMP) \
+	X(PUSH) X(LOAD) X(STORE) X(POP) X(NEG) X(NOT) X(BOOL) \
+	X(ADD) X(ADD_K) X(ADD_V) X(SUB) X(SUB_K) X(SUB_V) X(MUL) X(MUL_K) X(MUL_V) \
+	X(CHECK_DIV) X(CHECK_MOD) X(DIV) X(MOD) X(DIV_K) X(MOD_K) \
+	X(LT) X(LT_K) X(LT_V) X(LE) X(LE_K) X(LE_V) X(GT) X(GT_K) X(GT_V) \
+	X(GE) X(GE_K) X(GE_V) X(EQ) X(EQ_K) X(EQ_V) X(NE) X(NE_K) X(NE_V) \
+	X(JNLT) X(JNLT_K) X(JNLT_V) X(JNLE) X(JNLE_K) X(JNLE_V) X(JNGT) X(JNGT_K) X(JNGT_V) \
+	X(JNGE) X(JNGE_K) X(JNGE_V) X(JNEQ) X(JNEQ_K) X(JNEQ_V) X(JNNE) X(JNNE_K) X(JNNE_V) \
+	X(PRINT_INT) X(PRINT_BOOL) X(PRINT_STR) X(READ)
+
+#define VM_ENUM(name) VM_##name,
+enum vm_op : uint32_t
+{
+	VM_OPCODES(VM_ENUM)
+	VM_OP_COUNT
+};
+#undef VM_ENUM
+
+static bool is_compare(uint32_t op)
+{
+	return op >= VM_LT && op <= VM_NE_V;
+}
+
+static bool is_jump(uint32_t op)
+{
+	return (op >= VM_CALL && op <= VM_OR_JUMP && op != VM_RET) || (op >= VM_JNLT && op <= VM_JNNE_V);
+}
+
+// What op does to the depth of the operand stack, on the path that does
+// not jump.
+static int stack_effect(uint32_t op)
+{
+	switch (op)
+	{
+	case VM_PUSH:
+	case VM_LOAD:
+		return 1;
+	case VM_JUMP_IF_FALSE:
+	case VM_JUMP_IF_TRUE:
+	case VM_AND_JUMP:
+	case VM_OR_JUMP:
+	case VM_STORE:
+	case VM_POP:
+	case VM_ADD:
+	case VM_SUB:
+	case VM_MUL:
+	case VM_DIV:
+	case VM_MOD:
+	case VM_PRINT_INT:
+	case VM_PRINT_BOOL:
+		return -1;
+	default:
+		if (is_compare(op))
+		{
+			return (op - VM_LT) % 3 == 0 ? -1 : 0;
+		}
+		if (op >= VM_JNLT && op <= VM_JNNE_V)
+		{
+			return (op - VM_JNLT) % 3 == 0 ? -2 : -1;
+		}
+		return 0;
+	}
+}
+
+// Lowers statements one at a time with an explicit stack of tasks, so deep
+// trees compile without deep recursion. A task compiles a node, emits an
+// instruction or places a label; sequence pushes a run of them so they
+// execute in the order written.
+template <typename View>
+class vm_compiler
+{
+public:
+	typedef typename View::ref ref;
+
+	vm_compiler(const View& view, const compilation_context& context, vm_program& out)
+		: v(view), ctx(context), program(out), barrier(0), depth(0)
+	{
+		program = vm_program();
+		program.variable_count = max(ctx.variable_values.size(), ctx.sym_table.size());
+	}
+
+	void compile(ref statement)
+	{
+		sequence({ statement_of(statement, false) });
+		run();
+	}
+
+	// An if in a statement list has the following statement as its else,
+	// and that statement also runs after it as the list goes on. Its code
+	// is therefore emitted once, as a subroutine, instead of once for each
+	// way it is reached.
+	void finish()
+	{
+		emit(VM_HALT);
+		for (size_t i = 0; i < pending.size(); i++)
+		{
+			place_label(pending[i].second);
+			sequence({ statement_of(pending[i].first, true) });
+			run();
+			emit(VM_RET);
+		}
+		for (size_t j : jumps)
+		{
+			program.code[j].b = (int32_t)labels[program.code[j].b];
+		}
+	}
+
+private:
+	enum task_kind { task_expression, task_statement, task_list, task_print, task_emit, task_place };
+	struct task
+	{
+		ref n;
+		task_kind kind;
+		bool listed;
+		uint32_t op;
+		int32_t a;
+		int32_t b;
+	};
+
+	const View& v;
+	const compilation_context& ctx;
+	vm_program& program;
+	vector<task> tasks;
+	vector<size_t> labels;
+	vector<size_t> jumps;
+	unordered_map<ref, int> subroutines;
+	vector<pair<ref, int>> pending;
+	size_t barrier;
+	int depth;
+
+	task expression_of(ref n) const { return { n, task_expression, false, 0, 0, 0 }; }
+	task statement_of(ref n, bool listed) const { return { n, task_statement, listed, 0, 0, 0 }; }
+	task list_of(ref head) const { return { head, task_list, false, 0, 0, 0 }; }
+	task print_of(ref argument) const { return { argument, task_print, false, 0, 0, 0 }; }
+	task instruction(uint32_t op, int32_t a = 0, int32_t b = 0) const { return { v.none(), task_emit, false, op, a, b }; }
+	task label_at(int label) const { return { v.none(), task_place, false, 0, label, 0 }; }
+
+	void sequence(initializer_list<task> run)
+	{
+		for (auto t = run.end(); t != run.begin();)
+		{
+			tasks.push_back(*--t);
+		}
+	}
+
+	int new_label()
+	{
+		labels.push_back(0);
+		return (int)labels.size() - 1;
+	}
+
+	void place_label(int label)
+	{
+		labels[label] = program.code.size();
+		barrier = program.code.size();
+	}
+
+	int subroutine(ref n)
+	{
+		auto found = subroutines.emplace(n, 0);
+		if (found.second)
+		{
+			found.first->second = new_label();
+			pending.push_back({ n, found.first->second });
+		}
+		return found.first->second;
+	}
+
+	int message(const string& text)
+	{
+		program.messages.push_back(text);
+		return (int)program.messages.size() - 1;
+	}
+
+	bool slot_valid(int index) const
+	{
+		return index >= 0 && (size_t)index < program.variable_count;
+	}
+
+	// Peephole: a jump on a comparison becomes the fused jump, and a 0/1
+	// value is not normalized again. Neither applies across a label, where
+	// another path joins.
+	void emit(uint32_t op, int32_t a = 0, int32_t b = 0)
+	{
+		vector<vm_instr>& code = program.code;
+		depth += stack_effect(op);
+		program.stack_size = max(program.stack_size, (size_t)max(depth, 0));
+
+		bool joined = code.empty() || barrier == code.size();
+		if (!joined && (op == VM_JUMP_IF_FALSE || op == VM_JUMP_IF_TRUE) && is_compare(code.back().op))
+		{
+			// Jumping when l < r holds is jumping unless l >= r holds.
+			static const uint32_t negated[] = { 3, 2, 1, 0, 5, 4 };
+			uint32_t compare = (code.back().op - VM_LT) / 3;
+			uint32_t form = (code.back().op - VM_LT) % 3;
+			code.back().op = VM_JNLT + 3 * (op == VM_JUMP_IF_TRUE ? negated[compare] : compare) + form;
+			code.back().b = b;
+			jumps.push_back(code.size() - 1);
+			return;
+		}
+		if (!joined && op == VM_BOOL && (is_compare(code.back().op) || code.back().op == VM_NOT || code.back().op == VM_BOOL))
+		{
+			return;
+		}
+		code.push_back({ op, a, b });
+		if (is_jump(op))
+		{
+			jumps.push_back(code.size() - 1);
+		}
+	}
+
+	void fail(const string& text)
+	{
+		emit(VM_FAIL, message(text));
+	}
+
+	// A failing expression still counts as the value it would have pushed.
+	void fail_value(const string& text)
+	{
+		fail(text);
+		emit(VM_PUSH, 0);
+	}
+
+	void run()
+	{
+		while (!tasks.empty())
+		{
+			task t = tasks.back();
+			tasks.pop_back();
+			switch (t.kind)
+			{
+			case task_emit:
+				emit(t.op, t.a, t.b);
+				break;
+			case task_place:
+				place_label(t.a);
+				break;
+			case task_expression:
+				expression(t.n);
+				break;
+			case task_statement:
+				statement(t.n, t.listed);
+				break;
+			case task_list:
+				if (t.n != v.none())
+				{
+					sequence({ statement_of(t.n, true), list_of(v.next(t.n)) });
+				}
+				break;
+			case task_print:
+				print_argument(t.n);
+				break;
+			}
+		}
+	}
+
+	// base is the stack form of the operator; a literal or variable right
+	// operand is folded into the instruction.
+	void binary(ref n, uint32_t base)
+	{
+		ref r = v.right(n);
+		if (r != v.none() && v.op(r) == TOKEN_INTEGER)
+		{
+			sequence({ expression_of(v.left(n)), instruction(base + 1, v.integer(r)) });
+		}
+		else if (r != v.none() && v.op(r) == TOKEN_IDENT && slot_valid(v.symbol(r)))
+		{
+			sequence({ expression_of(v.left(n)), instruction(base + 2, v.symbol(r)) });
+		}
+		else
+		{
+			sequence({ expression_of(v.left(n)), expression_of(r), instruction(base) });
+		}
+	}
+
+	void expression(ref n)
+	{
+		if (n == v.none())
+		{
+			emit(VM_PUSH, 0);
+			return;
+		}
+		token_id op = v.op(n);
+		switch (op)
+		{
+		case TOKEN_INTEGER:
+			emit(VM_PUSH, v.integer(n));
+			return;
+		case TOKEN_TRUE:
+			emit(VM_PUSH, 1);
+			return;
+		case TOKEN_FALSE:
+		case TOKEN_STRING:
+		case TOKEN_INT4:
+			emit(VM_PUSH, 0);
+			return;
+		case TOKEN_IDENT:
+			if (slot_valid(v.symbol(n)))
+			{
+				emit(VM_LOAD, v.symbol(n));
+			}
+			else
+			{
+				fail_value("Runtime Error: Invalid symbol table index " + to_string(v.symbol(n)) + " for " + string(v.text(n)));
+			}
+			return;
+
+		case TOKEN_MINUS:
+			if (v.left(n) == v.none() && v.right(n) != v.none())
+			{
+				sequence({ expression_of(v.right(n)), instruction(VM_NEG) });
+				return;
+			}
+			if (v.left(n) == v.none() || v.right(n) == v.none())
+			{
+				fail_value("Runtime Error: Invalid structure for TOKEN_MINUS node at line " + to_string(v.line(n)));
+				return;
+			}
+			binary(n, VM_SUB);
+			return;
+		case TOKEN_PLUS:       binary(n, VM_ADD); return;
+		case TOKEN_MULT:       binary(n, VM_MUL); return;
+		case TOKEN_LESS:       binary(n, VM_LT); return;
+		case TOKEN_LESS_EQ:    binary(n, VM_LE); return;
+		case TOKEN_GREATER:    binary(n, VM_GT); return;
+		case TOKEN_GREATER_EQ: binary(n, VM_GE); return;
+		case TOKEN_EQUAL:      binary(n, VM_EQ); return;
+		case TOKEN_NOT_EQUAL:  binary(n, VM_NE); return;
+
+		// The divisor is checked before the dividend is evaluated.
+		case TOKEN_DIV:
+		case TOKEN_MOD:
+		{
+			bool div = op == TOKEN_DIV;
+			ref r = v.right(n);
+			if (r != v.none() && v.op(r) == TOKEN_INTEGER && v.integer(r) != 0)
+			{
+				sequence({ expression_of(v.left(n)), instruction(div ? VM_DIV_K : VM_MOD_K, v.integer(r)) });
+			}
+			else
+			{
+				sequence({ expression_of(r), instruction(div ? VM_CHECK_DIV : VM_CHECK_MOD, v.line(n)),
+					expression_of(v.left(n)), instruction(div ? VM_DIV : VM_MOD) });
+			}
+			return;
+		}
+
+		case TOKEN_AND:
+		case TOKEN_OR:
+		{
+			int end = new_label();
+			sequence({ expression_of(v.left(n)), instruction(op == TOKEN_AND ? VM_AND_JUMP : VM_OR_JUMP, 0, end),
+				expression_of(v.right(n)), instruction(VM_BOOL), label_at(end) });
+			return;
+		}
+		case TOKEN_NOT:
+			sequence({ expression_of(v.left(n)), instruction(VM_NOT) });
+			return;
+
+		default:
+			fail_value("Runtime Error: Cannot evaluate node type: " + to_string((int)op) + " ('" + string(v.text(n)) + "') at line " + to_string(v.line(n)));
+			return;
+		}
+	}
+
+	void print_argument(ref argument)
+	{
+		if (argument == v.none())
+		{
+			return;
+		}
+		ref rest = v.next(argument);
+		switch (v.type(argument))
+		{
+		case vt_bool:
+			sequence({ expression_of(argument), instruction(VM_PRINT_BOOL), print_of(rest) });
+			break;
+		case vt_string:
+			if (v.op(argument) == TOKEN_STRING)
+			{
+				program.strings.push_back(v.string_value(ctx, argument));
+				sequence({ instruction(VM_PRINT_STR, (int32_t)program.strings.size() - 1), print_of(rest) });
+			}
+			else
+			{
+				sequence({ print_of(rest) });
+			}
+			break;
+		default:
+			sequence({ expression_of(argument), instruction(VM_PRINT_INT), print_of(rest) });
+			break;
+		}
+	}
+
+	void statement(ref n, bool listed)
+	{
+		if (n == v.none())
+		{
+			return;
+		}
+		switch (v.op(n))
+		{
+		case TOKEN_ASSIGN:
+		{
+			int slot = v.symbol(v.left(n));
+			sequence({ expression_of(v.right(n)), slot_valid(slot) ? instruction(VM_STORE, slot) : instruction(VM_FAIL, message("")) });
+			return;
+		}
+
+		case TOKEN_PRINT:
+			sequence({ print_of(v.left(n)) });
+			return;
+
+		case TOKEN_READ:
+		{
+			ref target = v.left(n);
+			if (target == v.none() || v.op(target) != TOKEN_IDENT)
+			{
+				fail("Runtime Error: Invalid structure for read node at line " + to_string(v.line(n)));
+			}
+			else if (!slot_valid(v.symbol(target)))
+			{
+				fail("Runtime Error: Invalid variable index (" + to_string(v.symbol(target)) + ") for read statement at line " + to_string(v.line(n)));
+			}
+			else
+			{
+				emit(VM_READ, v.symbol(target), v.line(n));
+			}
+			return;
+		}
+
+		case TOKEN_IF:
+		{
+			ref otherwise = v.next(n);
+			int end = new_label();
+			if (otherwise == v.none())
+			{
+				sequence({ expression_of(v.left(n)), instruction(VM_JUMP_IF_FALSE, 0, end), statement_of(v.right(n), false), label_at(end) });
+				return;
+			}
+			int other = new_label();
+			task else_part = listed ? instruction(VM_CALL, 0, subroutine(otherwise)) : statement_of(otherwise, false);
+			sequence({ expression_of(v.left(n)), instruction(VM_JUMP_IF_FALSE, 0, other), statement_of(v.right(n), false),
+				instruction(VM_JUMP, 0, end), label_at(other), else_part, label_at(end) });
+			return;
+		}
+
+		// The condition is tested at the bottom, so an iteration takes one
+		// jump.
+		case TOKEN_WHILE:
+		{
+			int body = new_label();
+			int test = new_label();
+			sequence({ instruction(VM_JUMP, 0, test), label_at(body), statement_of(v.right(n), false),
+				label_at(test), expression_of(v.left(n)), instruction(VM_JUMP_IF_TRUE, 0, body) });
+			return;
+		}
+
+		case TOKEN_BLOCK:
+			sequence({ list_of(v.left(n)) });
+			return;
+
+		case TOKEN_INT4:
+			return;
+
+		default:
+			sequence({ expression_of(n), instruction(VM_POP) });
+			return;
+		}
+	}
+};
+
+void vm_compile(const compilation_context& ctx, const vector<node*>& program_statements, vm_program& program)
+{
+	tree_view view;
+	vm_compiler<tree_view> compiler(view, ctx, program);
+	for (node* statement : program_statements)
+	{
+		compiler.compile(statement);
+	}
+	compiler.finish();
+}
+
+void vm_compile(const compilation_context& ctx, const compact_ast& ast, vm_program& program)
+{
+	compact_view view{ ast };
+	vm_compiler<compact_view> compiler(view, ctx, program);
+	for (uint32_t statement : ast.statements)
+	{
+		compiler.compile(statement);
+	}
+	compiler.finish();
+}
+
+// Dispatch jumps straight from one handler to the next through a table of
+// label addresses where the compiler supports it, and goes round a switch
+// elsewhere.
+#if defined(__GNUC__)
+#define VM_CASE(name) op_##name:
+#define VM_DISPATCH() goto *dispatch_table[pc->op]
+#else
+#define VM_CASE(name) case VM_##name:
+#define VM_DISPATCH() goto dispatch
+#endif
+#define VM_NEXT() pc++; VM_DISPATCH()
+
+#define VM_ARITHMETIC(name, result) \
+	VM_CASE(name) { int r = sp[-1]; int l = sp[-2]; sp--; sp[-1] = (result); VM_NEXT(); } \
+	VM_CASE(name##_K) { int r = pc->a; int l = sp[-1]; sp[-1] = (result); VM_NEXT(); } \
+	VM_CASE(name##_V) { int r = vars[pc->a]; int l = sp[-1]; sp[-1] = (result); VM_NEXT(); }
+
+#define VM_BRANCH(name, holds) \
+	VM_CASE(name) { int r = sp[-1]; int l = sp[-2]; sp -= 2; pc = (holds) ? pc + 1 : code + pc->b; VM_DISPATCH(); } \
+	VM_CASE(name##_K) { int r = pc->a; int l = *--sp; pc = (holds) ? pc + 1 : code + pc->b; VM_DISPATCH(); } \
+	VM_CASE(name##_V) { int r = vars[pc->a]; int l = *--sp; pc = (holds) ? pc + 1 : code + pc->b; VM_DISPATCH(); }
+
+void vm_run(compilation_context& ctx, const vm_program& program)
+{
+	if (ctx.variable_values.size() < program.variable_count)
+	{
+		ctx.variable_values.resize(program.variable_count, 0);
+	}
+	vector<int> stack(program.stack_size + 1);
+	vector<const vm_instr*> calls;
+	const vm_instr* code = program.code.data();
+	const vm_instr* pc = code;
+	int* sp = stack.data();
+	int* vars = ctx.variable_values.data();
+
+#if defined(__GNUC__)
+#define VM_LABEL(name) &&op_##name,
+	static void* const dispatch_table[] = { VM_OPCODES(VM_LABEL) };
+#undef VM_LABEL
+	VM_DISPATCH();
+#else
+dispatch:
+	switch (pc->op)
+	{
+#endif
+
+	VM_CASE(HALT)
+		return;
+	VM_CASE(FAIL)
+		output_flush(ctx.output);
+		if (!program.messages[pc->a].empty())
+		{
+			cerr << program.messages[pc->a] << endl;
+		}
+		exit(1);
+	VM_CASE(CALL)
+		calls.push_back(pc + 1);
+		pc = code + pc->b;
+		VM_DISPATCH();
+	VM_CASE(RET)
+		pc = calls.back();
+		calls.pop_back();
+		VM_DISPATCH();
+	VM_CASE(JUMP)
+		pc = code + pc->b;
+		VM_DISPATCH();
+	VM_CASE(JUMP_IF_FALSE)
+		pc = *--sp == 0 ? code + pc->b : pc + 1;
+		VM_DISPATCH();
+	VM_CASE(JUMP_IF_TRUE)
+		pc = *--sp != 0 ? code + pc->b : pc + 1;
+		VM_DISPATCH();
+	// Jump with the result left on the stack if the left operand decides.
+	VM_CASE(AND_JUMP)
+		if (sp[-1] == 0)
+		{
+			pc = code + pc->b;
+			VM_DISPATCH();
+		}
+		sp--;
+		VM_NEXT();
+	VM_CASE(OR_JUMP)
+		if (sp[-1] != 0)
+		{
+			sp[-1] = 1;
+			pc = code + pc->b;
+			VM_DISPATCH();
+		}
+		sp--;
+		VM_NEXT();
+
+	VM_CASE(PUSH)
+		*sp++ = pc->a;
+		VM_NEXT();
+	VM_CASE(LOAD)
+		*sp++ = vars[pc->a];
+		VM_NEXT();
+	VM_CASE(STORE)
+		vars[pc->a] = *--sp;
+		VM_NEXT();
+	VM_CASE(POP)
+		sp--;
+		VM_NEXT();
+	VM_CASE(NEG)
+		sp[-1] = -sp[-1];
+		VM_NEXT();
+	VM_CASE(NOT)
+		sp[-1] = sp[-1] == 0 ? 1 : 0;
+		VM_NEXT();
+	VM_CASE(BOOL)
+		sp[-1] = sp[-1] != 0 ? 1 : 0;
+		VM_NEXT();
+
+	VM_ARITHMETIC(ADD, l + r)
+	VM_ARITHMETIC(SUB, l - r)
+	VM_ARITHMETIC(MUL, l * r)
+
+	// The divisor is pushed first and the dividend on top of it.
+	VM_CASE(CHECK_DIV)
+		if (sp[-1] == 0)
+		{
+			output_flush(ctx.output);
+			cerr << "Runtime Error: Division by zero at line " << pc->a << endl;
+			exit(1);
+		}
+		VM_NEXT();
+	VM_CASE(CHECK_MOD)
+		if (sp[-1] == 0)
+		{
+			output_flush(ctx.output);
+			cerr << "Runtime Error: Modulo by zero at line " << pc->a << endl;
+			exit(1);
+		}
+		VM_NEXT();
+	VM_CASE(DIV)
+		sp[-2] = sp[-1] / sp[-2];
+		sp--;
+		VM_NEXT();
+	VM_CASE(MOD)
+		sp[-2] = sp[-1] % sp[-2];
+		sp--;
+		VM_NEXT();
+	VM_CASE(DIV_K)
+		sp[-1] = sp[-1] / pc->a;
+		VM_NEXT();
+	VM_CASE(MOD_K)
+		sp[-1] = sp[-1] % pc->a;
+		VM_NEXT();
+
+	VM_ARITHMETIC(LT, l < r ? 1 : 0)
+	VM_ARITHMETIC(LE, l <= r ? 1 : 0)
+	VM_ARITHMETIC(GT, l > r ? 1 : 0)
+	VM_ARITHMETIC(GE, l >= r ? 1 : 0)
+	VM_ARITHMETIC(EQ, l == r ? 1 : 0)
+	VM_ARITHMETIC(NE, l != r ? 1 : 0)
+
+	VM_BRANCH(JNLT, l < r)
+	VM_BRANCH(JNLE, l <= r)
+	VM_BRANCH(JNGT, l > r)
+	VM_BRANCH(JNGE, l >= r)
+	VM_BRANCH(JNEQ, l == r)
+	VM_BRANCH(JNNE, l != r)
+
+	VM_CASE(PRINT_INT)
+		output_int(ctx.output, *--sp);
+		VM_NEXT();
+	VM_CASE(PRINT_BOOL)
+		output_bool(ctx.output, *--sp != 0);
+		VM_NEXT();
+	VM_CASE(PRINT_STR)
+		output_write(ctx.output, program.strings[pc->a]);
+		VM_NEXT();
+	VM_CASE(READ)
+		walk_read(ctx, pc->a, pc->b);
+		VM_NEXT();
+
+#if !defined(__GNUC__)
+	default:
+		return;
+	}
+#endif
+}
@@ -0,0 +1,45 @@
+#ifndef C_VM_H
+#define C_VM_H
+
+#include "c_ast.h"
+#include "c_tree.h"
+#include "context.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+// One instruction of the bytecode engine. What a and b hold depends on op:
+// a constant, a variable slot, a line, an index into strings or messages;
+// b is always the jump target of an instruction that jumps.
+struct vm_instr
+{
+	uint32_t op;
+	int32_t a;
+	int32_t b;
+};
+
+// A program lowered to a stack machine: the top-level statements in order,
+// a halt, then the subroutines the statements call. stack_size is the most
+// the operand stack ever holds.
+struct vm_program
+{
+	vector<vm_instr> code;
+	vector<string_view> strings;
+	vector<string> messages;
+	size_t stack_size = 0;
+	size_t variable_count = 0;
+};
+
+// Compiles after the tree is final (printed and optimized); the program
+// points into ctx.string_table, which must not change while it is used.
+void vm_compile(const compilation_context& ctx, const vector<node*>& program_statements, vm_program& program);
+void vm_compile(const compilation_context& ctx, const compact_ast& ast, vm_program& program);
+
+// Runs program with the output, input and runtime errors of the tree
+// walker.
+void vm_run(compilation_context& ctx, const vm_program& program);
+
+#endif
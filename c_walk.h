@@ -0,0 +1,899 @@
+#ifndef C_WALK_H
+#define C_WALK_H
+
+#include "c_tree.h"
+#include "c_ast.h"
+#include "context.h"
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+// The tree walks are written once against a view of either AST form. None
+// of them lets native stack use grow with the tree: evaluation recurses
+// only up to walk_recursion_limit levels and hands deeper subtrees to an
+// explicit-stack evaluator; printing and code generation always use one.
+struct tree_view
+{
+	typedef const node* ref;
+
+	ref none() const { return nullptr; }
+	token_id op(ref n) const { return n->token.id; }
+	ref left(ref n) const { return n->left; }
+	ref right(ref n) const { return n->right; }
+	ref next(ref n) const { return n->next; }
+	int line(ref n) const { return n->token.line; }
+	value_type type(ref n) const { return n->val_type; }
+	int integer(ref n) const { return n->value; }
+	int symbol(ref n) const { return n->symbol_table_index; }
+	string_view text(ref n) const { return n->token.val; }
+	int string_id(ref n) const { return n->value; }
+	string_view string_value(const compilation_context& ctx, ref n) const { return ctx.string_table[n->value]; }
+};
+
+struct compact_view
+{
+	typedef uint32_t ref;
+	const compact_ast& ast;
+
+	ref none() const { return ast_none; }
+	token_id op(ref n) const { return (token_id)ast.node_data[n].op; }
+	ref left(ref n) const { return ast.node_data[n].left; }
+	ref right(ref n) const { return ast.node_data[n].right; }
+	ref next(ref n) const { return ast.node_data[n].next; }
+	int line(ref n) const { return (int)ast.node_data[n].line; }
+	value_type type(ref n) const { return (value_type)ast.node_data[n].val_type; }
+	int integer(ref n) const { return ast.node_data[n].operand; }
+	int symbol(ref n) const { return ast.node_data[n].operand; }
+	string_view text(ref n) const { return ast.text(n); }
+	int string_id(ref n) const { return ast.node_data[n].operand; }
+	string_view string_value(const compilation_context& ctx, ref n) const { return ctx.string_table[ast.node_data[n].operand]; }
+};
+
+static const int walk_recursion_limit = 1024;
+
+// Reads an integer into variable index, for a read at line. Whatever print
+// wrote so far goes out first, so a prompt shows before the program waits.
+inline void walk_read(compilation_context& ctx, int index, int line)
+{
+	output_flush(ctx.output);
+	cout.flush();
+	int read_value;
+	if (!input_int(ctx.input, read_value)) {
+		cerr << "\nRuntime Error: Invalid or missing integer input for read at line " << line << endl;
+		exit(1);
+	}
+	ctx.variable_values[index] = read_value;
+}
+
+// Evaluates root, or the statement list starting at root when list is set,
+// keeping all state on the heap. Operands are evaluated left to right
+// except for / and mod, which check the divisor first.
+template <typename View>
+int walk_evaluate_deep(const View& v, compilation_context& ctx, typename View::ref root, bool list)
+{
+	typedef typename View::ref ref;
+	struct frame
+	{
+		ref n;
+		ref cur;
+		int stage;
+		int acc;
+		bool list;
+	};
+	static thread_local vector<frame> frame_stack;
+	static thread_local vector<int> value_stack;
+	vector<frame>& frames = frame_stack;
+	vector<int>& values = value_stack;
+
+	// Leaves are evaluated on the spot instead of getting a frame.
+	auto call = [&](ref n)
+	{
+		switch (v.op(n))
+		{
+		case TOKEN_INTEGER:
+			values.push_back(v.integer(n));
+			return;
+		case TOKEN_IDENT:
+		{
+			int index = v.symbol(n);
+			if (index >= 0 && index < (int)ctx.variable_values.size())
+			{
+				values.push_back(ctx.variable_values[index]);
+				return;
+			}
+			break;
+		}
+		case TOKEN_TRUE:
+			values.push_back(1);
+			return;
+		case TOKEN_FALSE:
+		case TOKEN_STRING:
+			values.push_back(0);
+			return;
+		default:
+			break;
+		}
+		frames.push_back({ n, v.none(), 0, 0, false });
+	};
+	auto call_list = [&](ref head) { frames.push_back({ head, v.none(), 0, 0, true }); };
+	auto finish = [&](int value) { frames.pop_back(); values.push_back(value); };
+	auto pop = [&]() { int value = values.back(); values.pop_back(); return value; };
+
+	frames.clear();
+	values.clear();
+	frames.push_back({ root, v.none(), 0, 0, list });
+
+	while (!frames.empty())
+	{
+		frame& f = frames.back();
+		ref n = f.n;
+
+		if (f.list)
+		{
+			if (f.stage == 0)
+			{
+				f.stage = 1;
+				f.cur = n;
+			}
+			else
+			{
+				f.acc = pop();
+				f.cur = v.next(f.cur);
+			}
+			if (f.cur == v.none())
+			{
+				finish(f.acc);
+			}
+			else
+			{
+				call(f.cur);
+			}
+			continue;
+		}
+
+		token_id op = v.op(n);
+		switch (op)
+		{
+		case TOKEN_INTEGER:
+			finish(v.integer(n));
+			break;
+		case TOKEN_TRUE:
+			finish(1);
+			break;
+		case TOKEN_FALSE:
+		case TOKEN_STRING:
+		case TOKEN_INT4:
+			finish(0);
+			break;
+		case TOKEN_IDENT:
+		{
+			int index = v.symbol(n);
+			if (index < 0 || index >= (int)ctx.variable_values.size())
+			{
+				output_flush(ctx.output);
+				cerr << "Runtime Error: Invalid symbol table index " << index << " for " << v.text(n) << endl;
+				exit(1);
+			}
+			finish(ctx.variable_values[index]);
+			break;
+		}
+
+		case TOKEN_MINUS:
+			if (v.left(n) == v.none() && v.right(n) != v.none())
+			{
+				if (f.stage == 0)
+				{
+					f.stage = 1;
+					call(v.right(n));
+				}
+				else
+				{
+					finish(-pop());
+				}
+				break;
+			}
+			if (v.left(n) == v.none() || v.right(n) == v.none())
+			{
+				output_flush(ctx.output);
+				cerr << "Runtime Error: Invalid structure for TOKEN_MINUS node at line " << v.line(n) << endl;
+				exit(1);
+			}
+			// fall through
+		case TOKEN_PLUS:
+		case TOKEN_MULT:
+		case TOKEN_LESS:
+		case TOKEN_LESS_EQ:
+		case TOKEN_GREATER:
+		case TOKEN_GREATER_EQ:
+		case TOKEN_EQUAL:
+		case TOKEN_NOT_EQUAL:
+			if (f.stage < 2)
+			{
+				f.stage++;
+				call(f.stage == 1 ? v.left(n) : v.right(n));
+				break;
+			}
+			{
+				int r = pop();
+				int l = pop();
+				switch (op)
+				{
+				case TOKEN_PLUS:       finish(l + r); break;
+				case TOKEN_MINUS:      finish(l - r); break;
+				case TOKEN_MULT:       finish(l * r); break;
+				case TOKEN_LESS:       finish(l < r ? 1 : 0); break;
+				case TOKEN_LESS_EQ:    finish(l <= r ? 1 : 0); break;
+				case TOKEN_GREATER:    finish(l > r ? 1 : 0); break;
+				case TOKEN_GREATER_EQ: finish(l >= r ? 1 : 0); break;
+				case TOKEN_EQUAL:      finish(l == r ? 1 : 0); break;
+				default:               finish(l != r ? 1 : 0); break;
+				}
+			}
+			break;
+
+		case TOKEN_DIV:
+		case TOKEN_MOD:
+			if (f.stage == 0)
+			{
+				f.stage = 1;
+				call(v.right(n));
+			}
+			else if (f.stage == 1)
+			{
+				f.acc = pop();
+				if (f.acc == 0)
+				{
+					output_flush(ctx.output);
+					cerr << "Runtime Error: " << (op == TOKEN_DIV ? "Division" : "Modulo") << " by zero at line " << v.line(n) << endl;
+					exit(1);
+				}
+				f.stage = 2;
+				call(v.left(n));
+			}
+			else
+			{
+				int l = pop();
+				finish(op == TOKEN_DIV ? l / f.acc : l % f.acc);
+			}
+			break;
+
+		case TOKEN_AND:
+		case TOKEN_OR:
+			if (f.stage == 0)
+			{
+				f.stage = 1;
+				call(v.left(n));
+			}
+			else if (f.stage == 1)
+			{
+				bool l = pop() != 0;
+				if (l == (op == TOKEN_OR))
+				{
+					finish(l ? 1 : 0);
+				}
+				else
+				{
+					f.stage = 2;
+					call(v.right(n));
+				}
+			}
+			else
+			{
+				finish(pop() != 0 ? 1 : 0);
+			}
+			break;
+
+		case TOKEN_NOT:
+			if (f.stage == 0)
+			{
+				f.stage = 1;
+				call(v.left(n));
+			}
+			else
+			{
+				finish(pop() == 0 ? 1 : 0);
+			}
+			break;
+
+		case TOKEN_ASSIGN:
+			if (f.stage == 0)
+			{
+				f.stage = 1;
+				call(v.right(n));
+			}
+			else
+			{
+				int target_var_index = v.symbol(v.left(n));
+				int value_to_assign = pop();
+				if (target_var_index < 0 || target_var_index >= (int)ctx.variable_values.size())
+				{
+					output_flush(ctx.output);
+					exit(1);
+				}
+				ctx.variable_values[target_var_index] = value_to_assign;
+				finish(value_to_assign);
+			}
+			break;
+
+		case TOKEN_PRINT:
+			if (f.stage == 0)
+			{
+				f.cur = v.left(n);
+			}
+			else
+			{
+				int value = pop();
+				if (f.stage == 2)
+				{
+					output_bool(ctx.output, value != 0);
+				}
+				else
+				{
+					output_int(ctx.output, value);
+				}
+				f.cur = v.next(f.cur);
+			}
+			f.stage = 1;
+			while (f.cur != v.none() && v.type(f.cur) == vt_string)
+			{
+				if (v.op(f.cur) == TOKEN_STRING)
+				{
+					output_write(ctx.output, v.string_value(ctx, f.cur));
+				}
+				f.cur = v.next(f.cur);
+			}
+			if (f.cur == v.none())
+			{
+				finish(0);
+			}
+			else
+			{
+				f.stage = v.type(f.cur) == vt_bool ? 2 : 3;
+				call(f.cur);
+			}
+			break;
+
+		case TOKEN_READ:
+		{
+			if (v.left(n) == v.none() || v.op(v.left(n)) != TOKEN_IDENT)
+			{
+				output_flush(ctx.output);
+				cerr << "Runtime Error: Invalid structure for read node at line " << v.line(n) << endl;
+				exit(1);
+			}
+
+			int target_var_index = v.symbol(v.left(n));
+			if (target_var_index < 0 || target_var_index >= (int)ctx.variable_values.size())
+			{
+				output_flush(ctx.output);
+				cerr << "Runtime Error: Invalid variable index (" << target_var_index << ") for read statement at line " << v.line(n) << endl;
+				exit(1);
+			}
+
+			walk_read(ctx, target_var_index, v.line(n));
+			finish(0);
+			break;
+		}
+
+		case TOKEN_IF:
+			if (f.stage == 0)
+			{
+				f.stage = 1;
+				call(v.left(n));
+			}
+			else if (f.stage == 1)
+			{
+				ref body = pop() != 0 ? v.right(n) : v.next(n);
+				if (body == v.none())
+				{
+					finish(0);
+				}
+				else
+				{
+					f.stage = 2;
+					if (v.op(body) == TOKEN_BLOCK)
+					{
+						call_list(v.left(body));
+					}
+					else
+					{
+						call(body);
+					}
+				}
+			}
+			else
+			{
+				finish(pop());
+			}
+			break;
+
+		case TOKEN_WHILE:
+			if (f.stage == 0)
+			{
+				f.stage = 1;
+				call(v.left(n));
+			}
+			else if (f.stage == 1)
+			{
+				if (pop() == 0)
+				{
+					finish(f.acc);
+				}
+				else
+				{
+					ref body = v.right(n);
+					f.stage = 2;
+					if (v.op(body) == TOKEN_BLOCK)
+					{
+						call_list(v.left(body));
+					}
+					else
+					{
+						call(body);
+					}
+				}
+			}
+			else
+			{
+				f.acc = pop();
+				f.stage = 1;
+				call(v.left(n));
+			}
+			break;
+
+		case TOKEN_BLOCK:
+			if (f.stage == 0)
+			{
+				f.stage = 1;
+				call_list(v.left(n));
+			}
+			else
+			{
+				finish(pop());
+			}
+			break;
+
+		default:
+			output_flush(ctx.output);
+			cerr << "Runtime Error: Cannot evaluate node type: " << op << " ('" << v.text(n) << "') at line " << v.line(n) << endl;
+			exit(1);
+		}
+	}
+	return values.back();
+}
+
+// checked is false only for a program walk_verify_program accepted; the
+// checks it made once are then left out here.
+template <typename View, bool checked = true>
+int walk_evaluate(const View& v, compilation_context& ctx, typename View::ref n, int depth = 0);
+
+template <typename View, bool checked = true>
+int walk_evaluate_list(const View& v, compilation_context& ctx, typename View::ref head, int depth = 0)
+{
+	int last_val = 0;
+	for (typename View::ref current = head; current != v.none(); current = v.next(current))
+	{
+		last_val = walk_evaluate<View, checked>(v, ctx, current, depth);
+	}
+	return last_val;
+}
+
+// The fast path: plain recursion, the same evaluation order as
+// walk_evaluate_deep, until the tree gets too deep for it.
+template <typename View, bool checked>
+int walk_evaluate(const View& v, compilation_context& ctx, typename View::ref n, int depth)
+{
+	typedef typename View::ref ref;
+	if (checked && depth == 0 && ctx.variable_values.size() < ctx.sym_table.size())
+	{
+		ctx.variable_values.resize(ctx.sym_table.size(), 0);
+	}
+	if (depth >= walk_recursion_limit)
+	{
+		return walk_evaluate_deep(v, ctx, n, false);
+	}
+	auto eval = [&](ref child) { return walk_evaluate<View, checked>(v, ctx, child, depth + 1); };
+	auto body = [&](ref child) { return v.op(child) == TOKEN_BLOCK ? walk_evaluate_list<View, checked>(v, ctx, v.left(child), depth + 1) : eval(child); };
+
+	token_id op = v.op(n);
+	switch (op)
+	{
+	case TOKEN_INTEGER:
+		return v.integer(n);
+	case TOKEN_TRUE:
+		return 1;
+	case TOKEN_FALSE:
+	case TOKEN_STRING:
+	case TOKEN_INT4:
+		return 0;
+	case TOKEN_IDENT:
+	{
+		int index = v.symbol(n);
+		if (checked && (index < 0 || index >= (int)ctx.variable_values.size()))
+		{
+			output_flush(ctx.output);
+			cerr << "Runtime Error: Invalid symbol table index " << index << " for " << v.text(n) << endl;
+			exit(1);
+		}
+		return ctx.variable_values[index];
+	}
+
+	case TOKEN_MINUS:
+		if (v.left(n) == v.none() && v.right(n) != v.none())
+		{
+			return -eval(v.right(n));
+		}
+		if (checked && (v.left(n) == v.none() || v.right(n) == v.none()))
+		{
+			output_flush(ctx.output);
+			cerr << "Runtime Error: Invalid structure for TOKEN_MINUS node at line " << v.line(n) << endl;
+			exit(1);
+		}
+		// fall through
+	case TOKEN_PLUS:
+	case TOKEN_MULT:
+	case TOKEN_LESS:
+	case TOKEN_LESS_EQ:
+	case TOKEN_GREATER:
+	case TOKEN_GREATER_EQ:
+	case TOKEN_EQUAL:
+	case TOKEN_NOT_EQUAL:
+	{
+		int l = eval(v.left(n));
+		int r = eval(v.right(n));
+		switch (op)
+		{
+		case TOKEN_PLUS:       return l + r;
+		case TOKEN_MINUS:      return l - r;
+		case TOKEN_MULT:       return l * r;
+		case TOKEN_LESS:       return l < r ? 1 : 0;
+		case TOKEN_LESS_EQ:    return l <= r ? 1 : 0;
+		case TOKEN_GREATER:    return l > r ? 1 : 0;
+		case TOKEN_GREATER_EQ: return l >= r ? 1 : 0;
+		case TOKEN_EQUAL:      return l == r ? 1 : 0;
+		default:               return l != r ? 1 : 0;
+		}
+	}
+
+	case TOKEN_DIV:
+	case TOKEN_MOD:
+	{
+		int r = eval(v.right(n));
+		if (r == 0)
+		{
+			output_flush(ctx.output);
+			cerr << "Runtime Error: " << (op == TOKEN_DIV ? "Division" : "Modulo") << " by zero at line " << v.line(n) << endl;
+			exit(1);
+		}
+		int l = eval(v.left(n));
+		return op == TOKEN_DIV ? l / r : l % r;
+	}
+
+	case TOKEN_AND:
+		return (eval(v.left(n)) != 0 && eval(v.right(n)) != 0) ? 1 : 0;
+	case TOKEN_OR:
+		return (eval(v.left(n)) != 0 || eval(v.right(n)) != 0) ? 1 : 0;
+	case TOKEN_NOT:
+		return eval(v.left(n)) == 0 ? 1 : 0;
+
+	case TOKEN_ASSIGN:
+	{
+		int target_var_index = v.symbol(v.left(n));
+		int value_to_assign = eval(v.right(n));
+		if (checked && (target_var_index < 0 || target_var_index >= (int)ctx.variable_values.size()))
+		{
+			output_flush(ctx.output);
+			exit(1);
+		}
+		ctx.variable_values[target_var_index] = value_to_assign;
+		return value_to_assign;
+	}
+
+	case TOKEN_PRINT:
+		for (ref expr = v.left(n); expr != v.none(); expr = v.next(expr))
+		{
+			if (v.type(expr) == vt_bool)
+			{
+				output_bool(ctx.output, eval(expr) != 0);
+			}
+			else if (v.type(expr) == vt_string)
+			{
+				if (v.op(expr) == TOKEN_STRING)
+				{
+					output_write(ctx.output, v.string_value(ctx, expr));
+				}
+			}
+			else
+			{
+				output_int(ctx.output, eval(expr));
+			}
+		}
+		return 0;
+
+	case TOKEN_IF:
+		if (eval(v.left(n)) != 0)
+		{
+			return body(v.right(n));
+		}
+		if (v.next(n) != v.none())
+		{
+			return body(v.next(n));
+		}
+		return 0;
+
+	case TOKEN_WHILE:
+	{
+		int last_val = 0;
+		while (eval(v.left(n)) != 0)
+		{
+			last_val = body(v.right(n));
+		}
+		return last_val;
+	}
+
+	case TOKEN_BLOCK:
+		return walk_evaluate_list<View, checked>(v, ctx, v.left(n), depth + 1);
+
+	case TOKEN_READ:
+		if (!checked)
+		{
+			walk_read(ctx, v.symbol(v.left(n)), v.line(n));
+			return 0;
+		}
+		return walk_evaluate_deep(v, ctx, n, false);
+
+	default:
+		// anything unexpected
+		return walk_evaluate_deep(v, ctx, n, false);
+	}
+}
+
+// Checks once what the walker would check at every node it reaches: that
+// each operator has the operands it needs and that every symbol and string
+// id is in range. Anything it does not know is rejected, so an accepted
+// program can run unchecked; a rejected one runs checked and fails where
+// it always did.
+template <typename View>
+bool walk_verify(const View& v, const compilation_context& ctx, typename View::ref root)
+{
+	typedef typename View::ref ref;
+	static thread_local vector<ref> node_stack;
+	vector<ref>& nodes = node_stack;
+	auto variable = [&](ref n)
+	{
+		return n != v.none() && v.op(n) == TOKEN_IDENT && v.symbol(n) >= 0 && (size_t)v.symbol(n) < ctx.sym_table.size();
+	};
+
+	nodes.clear();
+	nodes.push_back(root);
+	while (!nodes.empty())
+	{
+		ref n = nodes.back();
+		nodes.pop_back();
+		if (n == v.none())
+		{
+			continue;
+		}
+		bool valid;
+		switch (v.op(n))
+		{
+		case TOKEN_INTEGER:
+		case TOKEN_TRUE:
+		case TOKEN_FALSE:
+		case TOKEN_INT4:
+		case TOKEN_PRINT:
+		case TOKEN_BLOCK:
+			valid = true;
+			break;
+		case TOKEN_STRING:
+			valid = v.string_id(n) >= 0 && (size_t)v.string_id(n) < ctx.string_table.size();
+			break;
+		case TOKEN_IDENT:
+			valid = variable(n);
+			break;
+		case TOKEN_MINUS:
+			valid = v.right(n) != v.none();
+			break;
+		case TOKEN_NOT:
+			valid = v.left(n) != v.none();
+			break;
+		case TOKEN_ASSIGN:
+			valid = variable(v.left(n)) && v.right(n) != v.none();
+			break;
+		case TOKEN_READ:
+			valid = variable(v.left(n));
+			break;
+		case TOKEN_PLUS:
+		case TOKEN_MULT:
+		case TOKEN_DIV:
+		case TOKEN_MOD:
+		case TOKEN_LESS:
+		case TOKEN_LESS_EQ:
+		case TOKEN_GREATER:
+		case TOKEN_GREATER_EQ:
+		case TOKEN_EQUAL:
+		case TOKEN_NOT_EQUAL:
+		case TOKEN_AND:
+		case TOKEN_OR:
+		case TOKEN_IF:
+		case TOKEN_WHILE:
+			valid = v.left(n) != v.none() && v.right(n) != v.none();
+			break;
+		default:
+			valid = false;
+			break;
+		}
+		if (!valid)
+		{
+			return false;
+		}
+		nodes.push_back(v.next(n));
+		nodes.push_back(v.right(n));
+		nodes.push_back(v.left(n));
+	}
+	return true;
+}
+
+// Verifies every statement and, if all pass, sizes the variable frame and
+// sets ctx.verified.
+template <typename View, typename Roots>
+bool walk_verify_program(const View& v, compilation_context& ctx, const Roots& roots)
+{
+	ctx.verified = false;
+	for (typename View::ref root : roots)
+	{
+		if (!walk_verify(v, ctx, root))
+		{
+			return false;
+		}
+	}
+	if (ctx.variable_values.size() < ctx.sym_table.size())
+	{
+		ctx.variable_values.resize(ctx.sym_table.size(), 0);
+	}
+	ctx.verified = true;
+	return true;
+}
+
+template <typename View>
+void walk_print(const View& v, typename View::ref root, int space)
+{
+	typedef typename View::ref ref;
+	enum task_kind { task_node, task_chain, task_else };
+	struct task
+	{
+		ref n;
+		int space;
+		task_kind kind;
+	};
+	static thread_local vector<task> task_stack;
+	vector<task>& tasks = task_stack;
+
+	auto indent = [](int count)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			cout << " ";
+		}
+	};
+	auto operands = [&](ref n, int at)
+	{
+		tasks.push_back({ v.right(n), at + 2, task_node });
+		tasks.push_back({ v.left(n), at + 2, task_node });
+	};
+
+	tasks.clear();
+	tasks.push_back({ root, space, task_node });
+	while (!tasks.empty())
+	{
+		task t = tasks.back();
+		tasks.pop_back();
+		ref n = t.n;
+		if (t.kind == task_else)
+		{
+			indent(t.space);
+			cout << "else" << endl;
+			continue;
+		}
+		if (n == v.none())
+		{
+			continue;
+		}
+		if (t.kind == task_chain)
+		{
+			tasks.push_back({ v.next(n), t.space, task_chain });
+			tasks.push_back({ n, t.space, task_node });
+			continue;
+		}
+
+		indent(t.space);
+		switch (v.op(n))
+		{
+		case TOKEN_PRINT:
+		case TOKEN_BLOCK:
+			cout << (v.op(n) == TOKEN_PRINT ? "print" : "{ Block }") << endl;
+			tasks.push_back({ v.left(n), t.space + 2, task_chain });
+			break;
+		case TOKEN_IF:
+			cout << "if" << endl;
+			if (v.next(n) != v.none())
+			{
+				tasks.push_back({ v.next(n), t.space + 2, task_node });
+				tasks.push_back({ n, t.space, task_else });
+			}
+			operands(n, t.space);
+			break;
+		case TOKEN_READ:
+		case TOKEN_NOT:
+			cout << (v.op(n) == TOKEN_READ ? "read" : "!") << endl;
+			tasks.push_back({ v.left(n), t.space + 2, task_node });
+			break;
+		case TOKEN_MINUS:
+			if (v.left(n) == v.none() && v.right(n) != v.none())
+			{
+				cout << "- (neg)" << endl;
+				tasks.push_back({ v.right(n), t.space + 2, task_node });
+			}
+			else
+			{
+				cout << "- (sub)" << endl;
+				operands(n, t.space);
+			}
+			break;
+		case TOKEN_WHILE:      cout << "while" << endl;    operands(n, t.space); break;
+		case TOKEN_ASSIGN:     cout << "<-" << endl;       operands(n, t.space); break;
+		case TOKEN_PLUS:       cout << "+ (add)" << endl;  operands(n, t.space); break;
+		case TOKEN_MULT:       cout << "* (mult)" << endl; operands(n, t.space); break;
+		case TOKEN_DIV:        cout << "/ (div)" << endl;  operands(n, t.space); break;
+		case TOKEN_MOD:        cout << "mod" << endl;      operands(n, t.space); break;
+		case TOKEN_LESS:       cout << "<" << endl;        operands(n, t.space); break;
+		case TOKEN_LESS_EQ:    cout << "<=" << endl;       operands(n, t.space); break;
+		case TOKEN_GREATER:    cout << ">" << endl;        operands(n, t.space); break;
+		case TOKEN_GREATER_EQ: cout << ">=" << endl;       operands(n, t.space); break;
+		case TOKEN_EQUAL:      cout << "=" << endl;        operands(n, t.space); break;
+		case TOKEN_NOT_EQUAL:  cout << "~=" << endl;       operands(n, t.space); break;
+		case TOKEN_AND:        cout << "&" << endl;        operands(n, t.space); break;
+		case TOKEN_OR:         cout << "|" << endl;        operands(n, t.space); break;
+		case TOKEN_INT4:
+			if (v.left(n) != v.none() && v.op(v.left(n)) == TOKEN_IDENT)
+			{
+				cout << "  variable: " << v.text(v.left(n)) << endl;
+			}
+			else
+			{
+				cout << "int4 declaration (unexpected structure)" << endl;
+			}
+			break;
+		case TOKEN_TRUE:
+			cout << "true" << endl;
+			break;
+		case TOKEN_FALSE:
+			cout << "false" << endl;
+			break;
+		case TOKEN_STRING:
+			if (v.text(n) == "\n")
+			{
+				cout << endl;
+			}
+			else
+			{
+				cout << v.text(n) << endl;
+			}
+			break;
+		case TOKEN_IDENT:
+			cout << "variable: " << v.text(n) << endl;
+			break;
+		case TOKEN_INTEGER:
+			cout << v.integer(n) << endl;
+			break;
+		default:
+			cout << v.text(n) << " (token: " << v.op(n) << ")" << endl;
+			break;
+		}
+	}
+}
+
+#endif
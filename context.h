@@ -0,0 +1,35 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include "error.h"
+#include "input.h"
+#include "lex.h"
+#include "output.h"
+#include "s_table.h"
+
+#include <vector>
+#include <string>
+using namespace std;
+
+// Everything one program needs from source to execution. Contexts share no
+// state, so separate programs can be compiled and run on separate threads.
+struct compilation_context
+{
+	lexer lex;
+	vector<symbol_data> sym_table;
+	vector<string> string_table;
+	vector<int> variable_values;
+	input_source input;
+	output_sink output;
+
+	// Set by verify_program: the program is known to be well formed and
+	// variable_values is sized for it, so the walker skips its checks.
+	bool verified = false;
+
+	// Parse errors so far. Parsing stops once max_errors are recorded;
+	// 0 means no limit.
+	vector<diagnostic> diagnostics;
+	size_t max_errors = 20;
+};
+
+#endif
@@ -23,6 +23,17 @@ struct Error
 	string string_val;
 };
 
+// A parse error held back until the whole file has been parsed; see
+// report_diagnostics. source_line is the text of the line, taken when the
+// error is recorded: by the time it is reported, a piped source may have
+// moved past it.
+struct diagnostic
+{
+	string message;
+	int line, col;
+	string source_line;
+};
+
 void print_error(const Error& e);
 
 #endif
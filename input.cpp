@@ -0,0 +1,167 @@
+#include "input.h"
+#include <charconv>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#ifndef _WIN32
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+using namespace std;
+
+static const size_t input_block_size = 1024 * 1024;
+
+static bool input_space(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static bool input_digit(char c)
+{
+	return (unsigned)(c - '0') < 10;
+}
+
+static void input_start(input_source& in)
+{
+	in.started = true;
+#ifndef _WIN32
+	struct stat st;
+	off_t offset = lseek(0, 0, SEEK_CUR);
+	if (fstat(0, &st) == 0 && S_ISREG(st.st_mode) && offset >= 0 && st.st_size > offset)
+	{
+		void* base = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, 0, 0);
+		if (base != MAP_FAILED)
+		{
+			madvise(base, (size_t)st.st_size, MADV_SEQUENTIAL);
+			in.mapped_base = base;
+			in.mapped_size = (size_t)st.st_size;
+			in.pos = (const char*)base + offset;
+			in.end = (const char*)base + st.st_size;
+			in.done = true;
+		}
+	}
+#endif
+}
+
+// Keeps the unconsumed bytes, moved to the front of block, and appends the
+// next block of standard input. Returns false at the end of input.
+static bool input_refill(input_source& in)
+{
+	if (in.done)
+	{
+		return false;
+	}
+	size_t kept = in.end - in.pos;
+	if (in.block.size() < kept + input_block_size)
+	{
+		vector<char> grown(kept + input_block_size);
+		if (kept > 0)
+		{
+			memcpy(grown.data(), in.pos, kept);
+		}
+		in.block.swap(grown);
+	}
+	else
+	{
+		memmove(in.block.data(), in.pos, kept);
+	}
+
+	char* buffer = in.block.data();
+#ifdef _WIN32
+	size_t n = fread(buffer + kept, 1, in.block.size() - kept, stdin);
+	if (n == 0)
+	{
+		in.done = true;
+	}
+#else
+	ssize_t n;
+	do
+	{
+		n = read(0, buffer + kept, in.block.size() - kept);
+	} while (n < 0 && errno == EINTR);
+	if (n <= 0)
+	{
+		n = 0;
+		in.done = true;
+	}
+#endif
+	in.pos = buffer;
+	in.end = buffer + kept + n;
+	return n > 0;
+}
+
+bool input_int(input_source& in, int& value)
+{
+	if (!in.started)
+	{
+		input_start(in);
+	}
+	for (;;)
+	{
+		while (in.pos < in.end && input_space(*in.pos))
+		{
+			in.pos++;
+		}
+		if (in.pos < in.end)
+		{
+			break;
+		}
+		if (!input_refill(in))
+		{
+			return false;
+		}
+	}
+
+	// The number must be resident up to the first byte that cannot extend
+	// it, which may be in a block not read yet.
+	size_t len = 0;
+	if (*in.pos == '-' || *in.pos == '+')
+	{
+		len = 1;
+	}
+	for (;;)
+	{
+		size_t available = in.end - in.pos;
+		while (len < available && input_digit(in.pos[len]))
+		{
+			len++;
+		}
+		if (len < available || !input_refill(in))
+		{
+			break;
+		}
+	}
+
+	const char* first = in.pos;
+	const char* last = in.pos + len;
+	bool negative = *first == '-';
+	if (*first == '-' || *first == '+')
+	{
+		first++;
+	}
+	unsigned long long magnitude;
+	if (first == last || from_chars(first, last, magnitude).ec != errc())
+	{
+		return false;
+	}
+	if (magnitude > (unsigned long long)INT_MAX + (negative ? 1 : 0))
+	{
+		return false;
+	}
+	value = negative ? (int)-(long long)magnitude : (int)magnitude;
+	in.pos = last;
+	return true;
+}
+
+void input_cleanup(input_source& in)
+{
+#ifndef _WIN32
+	if (in.mapped_base != nullptr)
+	{
+		munmap(in.mapped_base, in.mapped_size);
+	}
+#endif
+	in = input_source();
+}
@@ -0,0 +1,28 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <vector>
+using namespace std;
+
+// Where read takes its integers from: standard input, mapped whole when it
+// is a regular file and otherwise read in large blocks. Bytes [pos, end) are
+// resident and not yet consumed. Nothing is touched before the first read.
+struct input_source
+{
+	const char* pos = nullptr;
+	const char* end = nullptr;
+	vector<char> block;
+	void* mapped_base = nullptr;
+	size_t mapped_size = 0;
+	bool started = false;
+	bool done = false;
+};
+
+// Reads the next integer the way cin >> int does: skips whitespace, then
+// takes an optional sign and decimal digits. Returns false, having consumed
+// only the whitespace, when there is no integer or it does not fit an int.
+bool input_int(input_source& in, int& value);
+
+void input_cleanup(input_source& in);
+
+#endif
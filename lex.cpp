@@ -1,324 +1,1009 @@
 #include "lex.h"
+#include "lex_scan.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
 using namespace std;
 
-char c;
+enum char_class : uint8_t
+{
+	CC_OTHER,
+	CC_END,
+	CC_SPACE,
+	CC_NEWLINE,
+	CC_HASH,
+	CC_ALPHA,
+	CC_DIGIT,
+	CC_LESS,
+	CC_GREATER,
+	CC_BANG,
+	CC_TILDE,
+	CC_EQUAL,
+	CC_MINUS,
+	CC_QUOTE,
+	CC_SINGLE,
+	CC_COUNT
+};
 
-Error lex_init(const char* src_code)
+// Values below LS_COUNT are DFA states; the rest are actions taken on the
+// current character instead of a transition.
+enum lex_state : uint8_t
 {
-	int result = buffer_init(src_code);
-	if (result != 0)
+	LS_START,
+	LS_COMMENT,
+	LS_IDENT,
+	LS_INTEGER,
+	LS_LESS,
+	LS_GREATER,
+	LS_BANG,
+	LS_TILDE,
+	LS_MINUS,
+	LS_LESS_EQ,
+	LS_ASSIGN,
+	LS_GREATER_EQ,
+	LS_NOT_EQUAL,
+	LS_EQUAL,
+	LS_SINGLE,
+	LS_COUNT,
+
+	LA_SKIP = LS_COUNT,
+	LA_ACCEPT,
+	LA_STRING,
+	LA_INVALID,
+	LA_INVALID_NEXT,
+	LA_END
+};
+
+static constexpr char single_chars[] = "+*/^(){}[]&|.@:;,";
+static constexpr token_id single_ids[] = {
+	TOKEN_PLUS, TOKEN_MULT, TOKEN_DIV, TOKEN_EXP, TOKEN_LPAREN, TOKEN_RPAREN,
+	TOKEN_LBRACE, TOKEN_RBRACE, TOKEN_LBRACKET, TOKEN_RBRACKET, TOKEN_AND, TOKEN_OR,
+	TOKEN_DOT, TOKEN_AT, TOKEN_COLON, TOKEN_SEMICOLON, TOKEN_COMMA
+};
+
+static constexpr array<uint8_t, 256> make_char_classes()
+{
+	array<uint8_t, 256> table{};
+	for (int i = 0; i < 256; i++)
 	{
-		return { NCC_FILE_NOT_FOUND, 0, 0 };
+		table[i] = CC_OTHER;
+	}
+	for (int i = 'a'; i <= 'z'; i++)
+	{
+		table[i] = CC_ALPHA;
+	}
+	for (int i = 'A'; i <= 'Z'; i++)
+	{
+		table[i] = CC_ALPHA;
+	}
+	for (int i = '0'; i <= '9'; i++)
+	{
+		table[i] = CC_DIGIT;
+	}
+	for (int i = 0; single_chars[i] != '\0'; i++)
+	{
+		table[(unsigned char)single_chars[i]] = CC_SINGLE;
+	}
+	table['_'] = CC_ALPHA;
+	table['\0'] = CC_END;
+	table[' '] = CC_SPACE;
+	table['\t'] = CC_SPACE;
+	table['\r'] = CC_SPACE;
+	table['\n'] = CC_NEWLINE;
+	table['#'] = CC_HASH;
+	table['<'] = CC_LESS;
+	table['>'] = CC_GREATER;
+	table['!'] = CC_BANG;
+	table['~'] = CC_TILDE;
+	table['='] = CC_EQUAL;
+	table['-'] = CC_MINUS;
+	table['"'] = CC_QUOTE;
+	return table;
+}
+
+static constexpr array<array<uint8_t, CC_COUNT>, LS_COUNT> make_lex_dfa()
+{
+	array<array<uint8_t, CC_COUNT>, LS_COUNT> dfa{};
+	for (int s = 0; s < LS_COUNT; s++)
+	{
+		for (int c = 0; c < CC_COUNT; c++)
+		{
+			dfa[s][c] = LA_ACCEPT;
+		}
+		dfa[s][CC_END] = LA_END;
+	}
+
+	dfa[LS_START][CC_OTHER] = LA_INVALID;
+	dfa[LS_START][CC_SPACE] = LA_SKIP;
+	dfa[LS_START][CC_NEWLINE] = LA_SKIP;
+	dfa[LS_START][CC_HASH] = LS_COMMENT;
+	dfa[LS_START][CC_ALPHA] = LS_IDENT;
+	dfa[LS_START][CC_DIGIT] = LS_INTEGER;
+	dfa[LS_START][CC_LESS] = LS_LESS;
+	dfa[LS_START][CC_GREATER] = LS_GREATER;
+	dfa[LS_START][CC_BANG] = LS_BANG;
+	dfa[LS_START][CC_TILDE] = LS_TILDE;
+	dfa[LS_START][CC_EQUAL] = LS_EQUAL;
+	dfa[LS_START][CC_MINUS] = LS_MINUS;
+	dfa[LS_START][CC_QUOTE] = LA_STRING;
+	dfa[LS_START][CC_SINGLE] = LS_SINGLE;
+
+	for (int c = 0; c < CC_COUNT; c++)
+	{
+		dfa[LS_COMMENT][c] = LS_COMMENT;
+		dfa[LS_TILDE][c] = LA_INVALID_NEXT;
 	}
-	return { NCC_OK, src_line_no, src_col_no };
+	dfa[LS_COMMENT][CC_NEWLINE] = LA_SKIP;
+	dfa[LS_COMMENT][CC_END] = LA_END;
+	dfa[LS_TILDE][CC_END] = LA_END;
+	dfa[LS_TILDE][CC_EQUAL] = LS_NOT_EQUAL;
 
+	dfa[LS_IDENT][CC_ALPHA] = LS_IDENT;
+	dfa[LS_IDENT][CC_DIGIT] = LS_IDENT;
+	dfa[LS_INTEGER][CC_DIGIT] = LS_INTEGER;
+	dfa[LS_LESS][CC_EQUAL] = LS_LESS_EQ;
+	dfa[LS_LESS][CC_MINUS] = LS_ASSIGN;
+	dfa[LS_GREATER][CC_EQUAL] = LS_GREATER_EQ;
+	dfa[LS_BANG][CC_EQUAL] = LS_NOT_EQUAL;
+	dfa[LS_MINUS][CC_MINUS] = LA_INVALID_NEXT;
+	return dfa;
 }
 
-Error get_token(Token& t)
+static constexpr array<uint8_t, LS_COUNT> make_state_tokens()
 {
-	char c;
-	t.val = "";
-	t.id = TOKEN_NULL;
-	t.line = src_line_no;
-	t.col = src_col_no;
+	array<uint8_t, LS_COUNT> tokens{};
+	tokens[LS_IDENT] = TOKEN_IDENT;
+	tokens[LS_INTEGER] = TOKEN_INTEGER;
+	tokens[LS_LESS] = TOKEN_LESS;
+	tokens[LS_GREATER] = TOKEN_GREATER;
+	tokens[LS_BANG] = TOKEN_NOT;
+	tokens[LS_MINUS] = TOKEN_MINUS;
+	tokens[LS_LESS_EQ] = TOKEN_LESS_EQ;
+	tokens[LS_ASSIGN] = TOKEN_ASSIGN;
+	tokens[LS_GREATER_EQ] = TOKEN_GREATER_EQ;
+	tokens[LS_NOT_EQUAL] = TOKEN_NOT_EQUAL;
+	tokens[LS_EQUAL] = TOKEN_EQUAL;
+	return tokens;
+}
+
+static constexpr array<uint8_t, 256> make_single_tokens()
+{
+	array<uint8_t, 256> tokens{};
+	for (int i = 0; single_chars[i] != '\0'; i++)
+	{
+		tokens[(unsigned char)single_chars[i]] = single_ids[i];
+	}
+	return tokens;
+}
+
+// Punctuation that only matters by kind carries no text in Token::val.
+static constexpr array<bool, TOKEN_FALSE + 1> make_text_tokens()
+{
+	array<bool, TOKEN_FALSE + 1> text{};
+	for (int i = 0; i <= TOKEN_FALSE; i++)
+	{
+		text[i] = true;
+	}
+	text[TOKEN_MULT] = false;
+	text[TOKEN_DIV] = false;
+	text[TOKEN_EXP] = false;
+	text[TOKEN_LBRACE] = false;
+	text[TOKEN_RBRACE] = false;
+	text[TOKEN_LBRACKET] = false;
+	text[TOKEN_RBRACKET] = false;
+	text[TOKEN_DOT] = false;
+	text[TOKEN_AT] = false;
+	text[TOKEN_COLON] = false;
+	text[TOKEN_SEMICOLON] = false;
+	text[TOKEN_COMMA] = false;
+	return text;
+}
+
+static constexpr array<uint8_t, 256> char_classes = make_char_classes();
+static constexpr array<array<uint8_t, CC_COUNT>, LS_COUNT> lex_dfa = make_lex_dfa();
+static constexpr array<uint8_t, LS_COUNT> state_tokens = make_state_tokens();
+static constexpr array<uint8_t, 256> single_tokens = make_single_tokens();
+static constexpr array<bool, TOKEN_FALSE + 1> text_tokens = make_text_tokens();
+
+static const size_t text_block_size = 64 * 1024;
+
+string_view text_arena::store(const char* data, size_t len)
+{
+	if (len == 0)
+	{
+		return string_view();
+	}
+	char* dst;
+	if (len > text_block_size / 4)
+	{
+		blocks.emplace_back(new char[len]);
+		dst = blocks.back().get();
+	}
+	else
+	{
+		if (len > left)
+		{
+			blocks.emplace_back(new char[text_block_size]);
+			cursor = blocks.back().get();
+			left = text_block_size;
+		}
+		dst = cursor;
+		cursor += len;
+		left -= len;
+	}
+	memcpy(dst, data, len);
+	return string_view(dst, len);
+}
+
+// A diagnostic held back until the token it belongs to is known to be part
+// of the final stream (see lex_parallel).
+struct lex_note
+{
+	size_t token_offset;
+	size_t offset;
+	string msg;
+};
+
+// Scanner state for one run over a source. get_token makes one at the
+// buffer cursor; the parallel lexer runs one per chunk with its own arena,
+// scratch and notes, so nothing here is shared between threads.
+struct lex_context
+{
+	source_buffer* source = nullptr;
+	size_t pos = 0;
+	bool streaming = false;
+	bool positions = true;
+	text_arena* arena = nullptr;
+	string* scratch = nullptr;
+	vector<lex_note>* notes = nullptr;
+};
+
+static lex_context make_context(lexer& lex, size_t pos, bool positions)
+{
+	lex_context lx;
+	lx.source = &lex.source;
+	lx.pos = pos;
+	lx.streaming = buffer_streaming(lex.source);
+	lx.positions = positions;
+	lx.arena = &lex.arena;
+	lx.scratch = &lex.scratch;
+	return lx;
+}
+
+static inline string_view lex_text(lex_context& lx, const char* data, size_t len)
+{
+	return lx.streaming ? lx.arena->store(data, len) : string_view(data, len);
+}
+
+static void mark_token_start(lex_context& lx, Token& t, size_t offset)
+{
+	t.offset = offset;
+	if (lx.positions)
+	{
+		buffer_line_col(*lx.source, offset, t.line, t.col);
+	}
+	else
+	{
+		t.line = 0;
+		t.col = 0;
+	}
+}
+
+static void lex_warning(source_buffer& source, const string& msg, size_t offset)
+{
+	int line, col;
+	buffer_line_col(source, offset, line, col);
+	cerr << msg << " at " << line << ":" << col << endl;
+}
+
+static void lex_warning(lex_context& lx, const Token& t, const string& msg, size_t offset)
+{
+	if (lx.notes != nullptr)
+	{
+		lx.notes->push_back({ t.offset, offset, msg });
+		return;
+	}
+	lex_warning(*lx.source, msg, offset);
+}
+
+// Keywords are found with a perfect hash on (length, first char, last char).
+// The multipliers are searched at compile time, so adding a keyword is just
+// another entry below; the static_assert fires if the slots become too few.
+struct keyword
+{
+	string_view text;
+	token_id id;
+};
+
+static constexpr keyword keywords[] = {
+	{ "true", TOKEN_TRUE },
+	{ "false", TOKEN_FALSE },
+	{ "mod", TOKEN_MOD },
+	{ "if", TOKEN_IF },
+	{ "else", TOKEN_ELSE },
+	{ "while", TOKEN_WHILE },
+	{ "print", TOKEN_PRINT },
+	{ "read", TOKEN_READ },
+	{ "int4", TOKEN_INT4 },
+};
+
+static constexpr size_t keyword_count = sizeof(keywords) / sizeof(keywords[0]);
+static constexpr size_t keyword_slots = 16;
 
+struct keyword_hash
+{
+	unsigned first_mul;
+	unsigned last_mul;
+	size_t min_len;
+	size_t max_len;
+	array<uint8_t, keyword_slots> slots;
+};
+
+static constexpr unsigned keyword_slot(unsigned first_mul, unsigned last_mul, size_t len, unsigned char first, unsigned char last)
+{
+	return (unsigned)(first * first_mul + last * last_mul + len) & (keyword_slots - 1);
+}
+
+static constexpr keyword_hash make_keyword_hash()
+{
+	keyword_hash h{};
+	h.min_len = keywords[0].text.size();
+	for (size_t k = 0; k < keyword_count; k++)
+	{
+		h.min_len = keywords[k].text.size() < h.min_len ? keywords[k].text.size() : h.min_len;
+		h.max_len = keywords[k].text.size() > h.max_len ? keywords[k].text.size() : h.max_len;
+	}
+
+	for (unsigned a = 1; a < 64; a++)
+	{
+		for (unsigned b = 1; b < 64; b++)
+		{
+			array<uint8_t, keyword_slots> slots{};
+			bool ok = true;
+			for (size_t k = 0; k < keyword_count && ok; k++)
+			{
+				string_view text = keywords[k].text;
+				unsigned slot = keyword_slot(a, b, text.size(), (unsigned char)text.front(), (unsigned char)text.back());
+				ok = slots[slot] == 0;
+				slots[slot] = (uint8_t)(k + 1);
+			}
+			if (ok)
+			{
+				h.first_mul = a;
+				h.last_mul = b;
+				h.slots = slots;
+				return h;
+			}
+		}
+	}
+	return h;
+}
+
+static constexpr keyword_hash keyword_table = make_keyword_hash();
+static_assert(keyword_table.first_mul != 0, "no collision-free keyword hash; increase keyword_slots");
+
+static inline token_id keyword_id(string_view s)
+{
+	if (s.size() < keyword_table.min_len || s.size() > keyword_table.max_len)
+	{
+		return TOKEN_IDENT;
+	}
+	unsigned slot = keyword_slot(keyword_table.first_mul, keyword_table.last_mul, s.size(), (unsigned char)s.front(), (unsigned char)s.back());
+	uint8_t k = keyword_table.slots[slot];
+	if (k != 0 && keywords[k - 1].text == s)
+	{
+		return keywords[k - 1].id;
+	}
+	return TOKEN_IDENT;
+}
+
+static Error lex_string(lex_context& lx, Token& t)
+{
+	size_t text_start = t.offset + 1;
+	size_t text_end = text_start;
+	size_t pos = text_start;
+	const char* p = buffer_at(*lx.source, pos);
+	const char* end = buffer_at(*lx.source, buffer_end(*lx.source));
+	bool closed = false;
+	bool verbatim = !lx.streaming;
+
+	t.id = TOKEN_STRING;
+	lx.scratch->clear();
 	while (true)
 	{
-		int e = buffer_peek_next_char(c);
-		if (e != 0)
+		const char* run = p;
+		while (*p != '"' && *p != '\\' && *p != '\0')
 		{
-			break;
+			p++;
 		}
+		if (!verbatim)
+		{
+			lx.scratch->append(run, p - run);
+		}
+		pos += p - run;
+		text_end = pos;
 
-		if (c == ' ' || c == '\t' || c == '\r')
+		if (*p == '"')
+		{
+			pos++;
+			closed = true;
+			break;
+		}
+		if (p == end || (*p == '\\' && p + 1 == end))
+		{
+			bool escape = p != end;
+			int more = buffer_refill(*lx.source, pos);
+			p = buffer_at(*lx.source, pos);
+			end = buffer_at(*lx.source, buffer_end(*lx.source));
+			if (more == 0)
+			{
+				continue;
+			}
+			if (escape)
+			{
+				lex_warning(lx, t, "wrong escape sequence at end of file in string literal", pos);
+				pos++;
+			}
+			break;
+		}
+		if (*p == '\0')
 		{
-			buffer_get_next_char(c);
-			src_col_no++;
+			if (!verbatim)
+			{
+				*lx.scratch += '\0';
+			}
+			p++;
+			pos++;
+			text_end = pos;
+			continue;
 		}
-		else if (c == '\n')
+
+		if (verbatim)
 		{
-			buffer_get_next_char(c);
-			src_line_no++;
-			src_col_no = 1;
+			lx.scratch->assign(buffer_at(*lx.source, text_start), text_end - text_start);
+			verbatim = false;
 		}
-		else if (c == '#')
+		char next_char = p[1];
+		switch (next_char)
 		{
-			buffer_get_next_char(c);
-			src_col_no++;
+		case 'n':  *lx.scratch += '\n'; break;
+		case 't':  *lx.scratch += '\t'; break;
+		case '\\': *lx.scratch += '\\'; break;
+		case '"':  *lx.scratch += '"';  break;
+		default:
+			lex_warning(lx, t, "wrong escape sequence '\\" + string(1, next_char) + "' in string literal", pos);
+			break;
+		}
+		p += 2;
+		pos += 2;
+	}
 
-			while (true)
+	if (!closed)
+	{
+		lex_warning(lx, t, "string literal error", t.offset);
+	}
+	t.val = verbatim ? string_view(buffer_at(*lx.source, text_start), text_end - text_start) : lx.arena->store(lx.scratch->data(), lx.scratch->size());
+	lx.pos = pos;
+	return { NCC_OK, t.line, t.col };
+}
+
+Error lex_init(lexer& lex, const char* src_code)
+{
+	int result = buffer_init(lex.source, src_code);
+	if (result != 0)
+	{
+		return { NCC_FILE_NOT_FOUND, 0, 0 };
+	}
+	return { NCC_OK, 1, 1 };
+
+}
+
+Error lex_init_text(lexer& lex, const char* text, size_t len)
+{
+	buffer_init_text(lex.source, text, len);
+	return { NCC_OK, 1, 1 };
+}
+
+static Error scan_token(lex_context& lx, Token& t)
+{
+	size_t start_off = lx.pos;
+	const char* start = buffer_at(*lx.source, start_off);
+	const char* end = buffer_at(*lx.source, buffer_end(*lx.source));
+	const char* p = start;
+	uint8_t state = LS_START;
+	uint8_t action;
+
+	t.val = string_view();
+	t.id = TOKEN_NULL;
+
+	while (true)
+	{
+		action = lex_dfa[state][char_classes[(unsigned char)*p]];
+		if (action < LS_COUNT)
+		{
+			state = action;
+			p++;
+			switch (state)
+			{
+			case LS_IDENT:   p = lex_scan.ident(p); break;
+			case LS_INTEGER: p = lex_scan.digits(p); break;
+			case LS_COMMENT: p = lex_scan.comment(p); break;
+			default: break;
+			}
+			continue;
+		}
+		if (action == LA_SKIP)
+		{
+			p = lex_scan.space(p + 1);
+			start_off += p - start;
+			start = p;
+			state = LS_START;
+			continue;
+		}
+		if (action == LA_END)
+		{
+			if (p != end)
 			{
-				int get_result = buffer_get_next_char(c);
-				if (get_result != 0)
+				action = lex_dfa[state][CC_OTHER];
+				if (action < LS_COUNT)
 				{
-					t.id = TOKEN_EOF;
-					t.line = src_line_no;
-					t.col = src_col_no;
-					return { NCC_OK, src_line_no, src_col_no };
+					state = action;
+					p++;
+					continue;
 				}
-				src_col_no++;
+				break;
+			}
 
-				if (c == '\n')
-				{
-					src_line_no++;
-					src_col_no = 1;
-					break;
-				}
+			if (state == LS_COMMENT)
+			{
+				start_off += p - start;
+				start = p;
 			}
-			continue;
+			size_t p_off = start_off + (p - start);
+			int more = buffer_refill(*lx.source, start_off);
+			start = buffer_at(*lx.source, start_off);
+			p = start + (p_off - start_off);
+			end = buffer_at(*lx.source, buffer_end(*lx.source));
+			if (more == 0)
+			{
+				continue;
+			}
+			if (state == LS_START || state == LS_COMMENT)
+			{
+				t.id = TOKEN_EOF;
+				mark_token_start(lx, t, p_off);
+				lx.pos = p_off;
+				return { NCC_OK, t.line, t.col };
+			}
+			action = state == LS_TILDE ? LA_INVALID_NEXT : LA_ACCEPT;
+		}
+		break;
+	}
+
+	mark_token_start(lx, t, start_off);
+	size_t end_off = start_off + (p - start);
+
+	switch (action)
+	{
+	case LA_ACCEPT:
+		t.id = (token_id)(state == LS_SINGLE ? single_tokens[(unsigned char)*start] : state_tokens[state]);
+		if (text_tokens[t.id])
+		{
+			t.val = lex_text(lx, start, p - start);
 		}
-		else
+		if (t.id == TOKEN_IDENT)
 		{
-			break;
+			t.id = keyword_id(t.val);
+		}
+		lx.pos = end_off;
+		return { NCC_OK, t.line, t.col };
+	case LA_STRING:
+		return lex_string(lx, t);
+	case LA_INVALID_NEXT:
+		if (state == LS_MINUS)
+		{
+			lex_warning(lx, t, "Invalid sequence '--'", start_off);
 		}
+		lx.pos = end_off;
+		return { NCC_INVALID_CHAR, t.line, t.col };
+	default:
+		lx.pos = end_off + 1;
+		return { NCC_INVALID_CHAR, t.line, t.col };
+	}
+}
+
+Error get_token(lexer& lex, Token& t)
+{
+	lex_context lx = make_context(lex, buffer_pos(lex.source), true);
+	Error e = scan_token(lx, t);
+	buffer_seek(lex.source, lx.pos);
+	return e;
+}
+
+Error get_token(lexer& lex, Token& t, vector<diagnostic>& notes)
+{
+	vector<lex_note> pending;
+	lex_context lx = make_context(lex, buffer_pos(lex.source), true);
+	lx.notes = &pending;
+	Error e = scan_token(lx, t);
+	buffer_seek(lex.source, lx.pos);
+	for (lex_note& n : pending)
+	{
+		int line, col;
+		buffer_line_col(lex.source, n.offset, line, col);
+		notes.push_back({ move(n.msg), line, col });
 	}
+	return e;
+}
 
-	t.line = src_line_no;
-	t.col = src_col_no;
+size_t token_stream::size() const
+{
+	return kind.size();
+}
 
-	if (buffer_peek_next_char(c) != 0)
+static inline uint32_t atom_hash(string_view text)
+{
+	uint32_t h = 2166136261u;
+	for (char c : text)
 	{
-		t.id = TOKEN_EOF;
-		return { NCC_OK, src_line_no, src_col_no };
+		h = (h ^ (unsigned char)c) * 16777619u;
 	}
+	return h;
+}
 
-	if (buffer_get_next_char(c) != 0)
+uint32_t token_stream::intern(string_view text)
+{
+	if (text.empty())
+	{
+		return 0;
+	}
+	if (atoms.size() * 2 >= atom_slots.size())
 	{
-		t.id = TOKEN_EOF;
-		return { NCC_OK, src_line_no, src_col_no };
+		vector<uint32_t> grown(max<size_t>(atom_slots.size() * 2, 1024), 0);
+		for (uint32_t id = 1; id < atoms.size(); id++)
+		{
+			size_t slot = atom_hash(atoms[id]) & (grown.size() - 1);
+			while (grown[slot] != 0)
+			{
+				slot = (slot + 1) & (grown.size() - 1);
+			}
+			grown[slot] = id;
+		}
+		atom_slots.swap(grown);
 	}
 
+	size_t mask = atom_slots.size() - 1;
+	size_t slot = atom_hash(text) & mask;
+	while (atom_slots[slot] != 0)
+	{
+		if (atoms[atom_slots[slot]] == text)
+		{
+			return atom_slots[slot];
+		}
+		slot = (slot + 1) & mask;
+	}
+	uint32_t id = (uint32_t)atoms.size();
+	atoms.push_back(text);
+	atom_slots[slot] = id;
+	return id;
+}
 
-	switch (c)
+void token_stream::push(const Token& t, size_t end_offset)
+{
+	kind.push_back((uint8_t)t.id);
+	offset.push_back((uint32_t)t.offset);
+	length.push_back((uint32_t)(end_offset - t.offset));
+	if (t.id == TOKEN_IDENT || t.id == TOKEN_INTEGER || t.id == TOKEN_STRING)
 	{
-	case '+':
+		atom.push_back(intern(t.val));
+		return;
+	}
+
+	// Operators have (almost) fixed text; remember the last atom per kind.
+	uint32_t& cached = kind_atom[t.id];
+	if (atoms[cached] != t.val)
 	{
-		t.id = TOKEN_PLUS;
-		t.val = "+";
-		return { NCC_OK, src_line_no, src_col_no };
+		cached = intern(t.val);
 	}
-	case '-':
+	atom.push_back(cached);
+}
+
+Token token_stream::get(size_t i) const
+{
+	Token t;
+	t.id = (token_id)kind[i];
+	t.offset = offset[i];
+	t.val = atoms[atom[i]];
+	buffer_line_col(*source, t.offset, t.line, t.col);
+	return t;
+}
+
+// Only reads the source, for parsers sharing one stream across threads.
+Token token_stream::get(size_t i, size_t& line_hint) const
+{
+	Token t;
+	t.id = (token_id)kind[i];
+	t.offset = offset[i];
+	t.val = atoms[atom[i]];
+	buffer_line_col(*source, t.offset, t.line, t.col, line_hint);
+	return t;
+}
+
+static void lex_start_stream(token_stream& ts, source_buffer& source, size_t estimate)
+{
+	ts = token_stream();
+	ts.source = &source;
+	ts.atoms.push_back(string_view());
+	fill(begin(ts.kind_atom), end(ts.kind_atom), 0);
+
+	ts.kind.reserve(estimate);
+	ts.offset.reserve(estimate);
+	ts.length.reserve(estimate);
+	ts.atom.reserve(estimate);
+}
+
+static Error lex_finish_stream(token_stream& ts, error_codes code, size_t offset)
+{
+	ts.error_index = ts.size();
+	ts.error = { code, 0, 0 };
+	buffer_line_col(*ts.source, offset, ts.error.line, ts.error.col);
+	return ts.error;
+}
+
+Error lex_all(lexer& lex, token_stream& ts)
+{
+	lex_start_stream(ts, lex.source, buffer_end(lex.source) / 3 + 1);
+
+	lex_context lx = make_context(lex, buffer_pos(lex.source), false);
+
+	Token t;
+	while (true)
 	{
-		if (buffer_peek_next_char(c) == 0 && c == '-')
+		Error e = scan_token(lx, t);
+		if (e.error != NCC_OK)
 		{
-			cerr << ("Invalid sequence '--'", t.line, t.col);
-			return { NCC_INVALID_CHAR, src_line_no, src_col_no };
+			buffer_seek(lex.source, lx.pos);
+			return lex_finish_stream(ts, e.error, t.offset);
 		}
-		t.id = TOKEN_MINUS;
-		t.val = "-";
-		return { NCC_OK, src_line_no, src_col_no };
-	}
-	case '*':	t.id = TOKEN_MULT; break;
-	case '/':	t.id = TOKEN_DIV; break;
-	case '^':	t.id = TOKEN_EXP; break;
-	case '<':
-		t.id = TOKEN_LESS;
-		t.val = "<";
-		if (buffer_peek_next_char(c) == 0 && c == '=')
+		ts.push(t, lx.pos);
+		if (t.id == TOKEN_EOF)
 		{
-			buffer_get_next_char(c);
-			t.id = TOKEN_LESS_EQ;
-			t.val = "<=";
+			break;
 		}
-		else if (buffer_peek_next_char(c) == 0 && c == '-')
+	}
+	buffer_seek(lex.source, lx.pos);
+	return lex_finish_stream(ts, NCC_OK, t.offset);
+}
+
+// One newline-aligned slice of the source. Its tokens are lexed assuming
+// the slice starts outside any token, with atoms local to the chunk; an
+// invalid character becomes a TOKEN_NULL entry so lexing can go on.
+struct lex_chunk
+{
+	size_t begin;
+	size_t end;
+	token_stream tokens;
+	vector<Error> errors;
+	vector<lex_note> notes;
+	text_arena arena;
+	string scratch;
+};
+
+static const size_t parallel_min_chunk = 256 * 1024;
+
+static void lex_chunk_run(lexer& lex, lex_chunk& chunk, bool last)
+{
+	lex_start_stream(chunk.tokens, lex.source, (chunk.end - chunk.begin) / 3 + 1);
+
+	lex_context lx = make_context(lex, chunk.begin, false);
+	lx.arena = &chunk.arena;
+	lx.scratch = &chunk.scratch;
+	lx.notes = &chunk.notes;
+
+	Token t;
+	while (true)
+	{
+		size_t notes = chunk.notes.size();
+		Error e = scan_token(lx, t);
+		if (!last && t.offset >= chunk.end)
+		{
+			chunk.notes.resize(notes);
+			break;
+		}
+		if (e.error != NCC_OK)
+		{
+			t.id = TOKEN_NULL;
+			t.val = string_view();
+			chunk.errors.push_back(e);
+		}
+		chunk.tokens.push(t, lx.pos);
+		if (t.id == TOKEN_EOF)
 		{
-			buffer_get_next_char(c);
-			t.id = TOKEN_ASSIGN;
-			t.val = "<-";
+			break;
 		}
-		return { NCC_OK, src_line_no, src_col_no };
-	case '>':
-		t.id = TOKEN_GREATER;
-		t.val = ">";
-		if (buffer_peek_next_char(c) == 0 && c == '=')
+	}
+}
+
+Error lex_parallel(lexer& lex, token_stream& ts, unsigned threads)
+{
+	size_t size = buffer_end(lex.source);
+	if (threads < 2 || buffer_streaming(lex.source) || buffer_pos(lex.source) != 0 || size < 2 * parallel_min_chunk || size > UINT32_MAX)
+	{
+		return lex_all(lex, ts);
+	}
+
+	// Chunks end just past a newline. Comments stop at one, so the only
+	// token that can run into the next chunk is a multi-line string.
+	const char* src = buffer_at(lex.source, 0);
+	size_t count = min<size_t>((size_t)threads * 4, size / parallel_min_chunk);
+	vector<lex_chunk> chunks;
+	size_t begin = 0;
+	for (size_t i = 1; i <= count && begin < size; i++)
+	{
+		size_t end = size;
+		if (i < count)
 		{
-			buffer_get_next_char(c);
-			t.id = TOKEN_GREATER_EQ;
-			t.val = ">=";
+			end = max(begin + 1, size * i / count);
+			const char* nl = (const char*)memchr(src + end, '\n', size - end);
+			end = nl == nullptr ? size : nl - src + 1;
 		}
-		return { NCC_OK, src_line_no, src_col_no };
+		chunks.emplace_back();
+		chunks.back().begin = begin;
+		chunks.back().end = end;
+		begin = end;
+	}
 
-	case '!':
-		t.id = TOKEN_NOT;
-		t.val = "!";
-		if (buffer_peek_next_char(c) == 0 && c == '=')
+	atomic<size_t> next_chunk(0);
+	auto worker = [&]()
+	{
+		size_t i;
+		while ((i = next_chunk++) < chunks.size())
 		{
-			buffer_get_next_char(c);
-			t.id = TOKEN_NOT_EQUAL;
-			t.val = "!=";
+			lex_chunk_run(lex, chunks[i], i + 1 == chunks.size());
 		}
-		return { NCC_OK, src_line_no, src_col_no };
-	case '(':
-		t.id = TOKEN_LPAREN;
-		t.val = "(";
-		return { NCC_OK, src_line_no, src_col_no };
-	case ')':
-		t.id = TOKEN_RPAREN;
-		t.val = ")";
-		return { NCC_OK, src_line_no, src_col_no };
-	case '{':	t.id = TOKEN_LBRACE; break;
-	case '}':	t.id = TOKEN_RBRACE; break;
-	case '[':	t.id = TOKEN_LBRACKET; break;
-	case ']':	t.id = TOKEN_RBRACKET; break;
-	case '&': t.id = TOKEN_AND; t.val = "&"; return { NCC_OK, src_line_no, src_col_no };
-	case '|':	t.id = TOKEN_OR; t.val = "|"; return { NCC_OK, src_line_no, src_col_no };
-	case '.':	t.id = TOKEN_DOT; break;
-	case '@':	t.id = TOKEN_AT; break;
-	case ':':	t.id = TOKEN_COLON; break;
-	case ';':	t.id = TOKEN_SEMICOLON; break;
-	case ',':	t.id = TOKEN_COMMA; break;
-	case '"':
-		t.id = TOKEN_STRING;
-		t.val = "";
-
-		char next_char;
-
-		while (buffer_peek_next_char(c) == 0)
+	};
+	vector<thread> pool;
+	for (unsigned i = 1; i < threads && i < chunks.size(); i++)
+	{
+		pool.emplace_back(worker);
+	}
+	worker();
+	for (thread& th : pool)
+	{
+		th.join();
+	}
+
+	// Splice the chunks in order. Atoms are interned at their first kept
+	// occurrence, so the ids come out exactly as lex_all assigns them.
+	lex_start_stream(ts, lex.source, size / 3 + 1);
+	vector<lex_note> notes;
+	size_t resume = 0;
+	error_codes error = NCC_OK;
+	size_t error_offset = 0;
+	vector<uint32_t> remap;
+
+	for (size_t c = 0; c < chunks.size() && error == NCC_OK; c++)
+	{
+		lex_chunk& chunk = chunks[c];
+		const token_stream& local = chunk.tokens;
+		size_t first = 0;
+
+		// The previous chunk ended inside a string: the guesses made here
+		// are wrong until a token starts where the real stream has one, and
+		// from a common token start on both lexers agree.
+		if (resume > chunk.begin)
 		{
-			buffer_get_next_char(c);
+			lex_context lx = make_context(lex, resume, false);
+			lx.notes = &notes;
 
-			if (c == '"')
-			{
-				break;
-			}
-			else if (c == '\\')
+			first = local.size();
+			while (true)
 			{
-				if (buffer_peek_next_char(next_char) != 0)
+				size_t kept_notes = notes.size();
+				Token t;
+				Error e = scan_token(lx, t);
+				if (c + 1 < chunks.size() && t.offset >= chunk.end)
 				{
-					cerr << ("wrong escape sequence at end of file in string literal", t.line, t.col + t.val.length());
-
+					notes.resize(kept_notes);
 					break;
 				}
-				buffer_get_next_char(next_char);
-
-				switch (next_char)
+				size_t j = lower_bound(local.offset.begin(), local.offset.end(), (uint32_t)t.offset) - local.offset.begin();
+				if (j < local.size() && local.offset[j] == t.offset)
+				{
+					notes.resize(kept_notes);
+					first = j;
+					break;
+				}
+				resume = lx.pos;
+				if (e.error != NCC_OK)
+				{
+					error = e.error;
+					error_offset = t.offset;
+					break;
+				}
+				ts.push(t, lx.pos);
+				if (t.id == TOKEN_EOF)
 				{
-				case 'n':  t.val += '\n'; break;
-				case 't':  t.val += '\t'; break;
-				case '\\': t.val += '\\'; break;
-				case '"':  t.val += '"';  break;
-				default:
-
-					cerr << ("wrong escape sequence '\\" + string(1, next_char) + "' in string literal", t.line, t.col + t.val.length());
-
 					break;
 				}
 			}
-			else
-			{
-				t.val += c;
-			}
-		}
-		if (c != '"')
-		{
-			cerr << ("string literal error", t.line, t.col);
-		}
-		return { NCC_OK, t.line, t.col };
-	case '~':
-		if (buffer_peek_next_char(c) == 0 && c == '=')
-		{
-			buffer_get_next_char(c);
-			t.id = TOKEN_NOT_EQUAL;
-			t.val = "~=";
 		}
-		else
+		if (first == local.size())
 		{
-			return { NCC_INVALID_CHAR, src_line_no, src_col_no };
+			continue;
 		}
-		return { NCC_OK, src_line_no, src_col_no };
-	case '=':
-		t.id = TOKEN_EQUAL;
-		t.val = "=";
-		return { NCC_OK, src_line_no, src_col_no };
-	default:
-		if (isalpha(c))
-		{
-			t.val = c;
-			while (buffer_get_next_char(c) == 0 && (isalnum(c) || c == '_'))
-			{
-				t.val += c;
-			}
-			buffer_back_char();
 
-			if (t.val == "true")
-			{
-				t.id = TOKEN_TRUE;
-			}
-			else if (t.val == "false")
-			{
-				t.id = TOKEN_FALSE;
-			}
-			else if (t.val == "mod")
-			{
-				t.id = TOKEN_MOD;
-			}
-			else if (t.val == "if")
-			{
-				t.id = TOKEN_IF;
-			}
-			else if (t.val == "else")
-			{
-				t.id = TOKEN_ELSE;
-			}
-			else if (t.val == "while")
-			{
-				t.id = TOKEN_WHILE;
-			}
-			else if (t.val == "print")
-			{
-				t.id = TOKEN_PRINT;
-			}
-			else if (t.val == "read")
-			{
-				t.id = TOKEN_READ;
-			}
-			else if (t.val == "int4")
+		remap.assign(local.atoms.size(), UINT32_MAX);
+		remap[0] = 0;
+		size_t error_slot = 0;
+		for (size_t i = 0; i < local.size(); i++)
+		{
+			if (local.kind[i] == TOKEN_NULL)
 			{
-				t.id = TOKEN_INT4;
+				if (i < first)
+				{
+					error_slot++;
+					continue;
+				}
+				error = chunk.errors[error_slot].error;
+				error_offset = local.offset[i];
+				resume = error_offset + local.length[i];
+				break;
 			}
-			else
+			if (i < first)
 			{
-				t.id = TOKEN_IDENT;
+				continue;
 			}
-			return { NCC_OK, src_line_no, src_col_no };
-		}
-		if (isdigit(c))
-		{
-			t.id = TOKEN_INTEGER;
-			t.val = "";
-			t.val = c;
-			int result = buffer_get_next_char(c);
-			while (result == 0 && isdigit(c))
+			uint32_t& id = remap[local.atom[i]];
+			if (id == UINT32_MAX)
 			{
-				t.val += c;
-				result = buffer_get_next_char(c);
+				id = ts.intern(local.atoms[local.atom[i]]);
 			}
-			buffer_back_char();
-			return { NCC_OK, src_line_no, src_col_no };
+			ts.kind.push_back(local.kind[i]);
+			ts.offset.push_back(local.offset[i]);
+			ts.length.push_back(local.length[i]);
+			ts.atom.push_back(id);
+			resume = (size_t)local.offset[i] + local.length[i];
 		}
-		if (c == '_')
+
+		size_t from = local.offset[first];
+		for (lex_note& n : chunk.notes)
 		{
-			t.id = TOKEN_IDENT;
-			t.val = c;
-			while (buffer_get_next_char(c) == 0 && isalnum(c) || c == '_')
+			if (n.token_offset >= from && (error == NCC_OK || n.token_offset <= error_offset))
 			{
-				t.val += c;
+				notes.push_back(move(n));
 			}
-			buffer_back_char();
-			return { NCC_OK, src_line_no, src_col_no };
 		}
-		t.id = TOKEN_NULL;
-		return { NCC_INVALID_CHAR, src_line_no, src_col_no };
+		lex.chunk_arenas.push_back(move(chunk.arena));
+	}
+
+	for (const lex_note& n : notes)
+	{
+		lex_warning(lex.source, n.msg, n.offset);
+	}
+	buffer_seek(lex.source, resume);
+	if (error != NCC_OK)
+	{
+		return lex_finish_stream(ts, error, error_offset);
 	}
-	return { NCC_OK, src_line_no, src_col_no };
+	return lex_finish_stream(ts, NCC_OK, ts.offset.back());
 }
 
-bool lex_eof(void)
+bool lex_eof(lexer& lex)
 {
-	return buffer_eof();
+	return buffer_eof(lex.source);
 }
 
-void lex_cleanup()
+void lex_cleanup(lexer& lex)
 {
-	buffer_cleanup();
+	buffer_cleanup(lex.source);
+	lex.arena = text_arena();
+	lex.chunk_arenas.clear();
+	lex.scratch.clear();
+	lex.scratch.shrink_to_fit();
 }
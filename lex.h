@@ -9,14 +9,70 @@
 #include <cctype>
 #include <fstream>
 #include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <memory>
 
-Error lex_init(const char* src_code);
+// Token text normally points straight into the source. Text that is not a
+// verbatim slice of it (strings with escapes, anything read from a stream
+// whose window moves on) is copied into an arena and lives until lex_cleanup.
+struct text_arena
+{
+	vector<unique_ptr<char[]>> blocks;
+	char* cursor = nullptr;
+	size_t left = 0;
 
-Error get_token(Token& t);
+	string_view store(const char* data, size_t len);
+};
 
-bool lex_eof(void);
+// Everything the lexer keeps per source; separate lexers share nothing.
+struct lexer
+{
+	source_buffer source;
+	text_arena arena;
+	vector<text_arena> chunk_arenas;
+	string scratch;
+};
 
-void lex_cleanup();
+// The whole source tokenized up front, one array per field. Token text is
+// interned: atom[i] indexes atoms, and atom 0 is the empty text.
+struct token_stream
+{
+	vector<uint8_t> kind;
+	vector<uint32_t> offset;
+	vector<uint32_t> length;
+	vector<uint32_t> atom;
+	vector<string_view> atoms;
+	vector<uint32_t> atom_slots;
+	uint32_t kind_atom[TOKEN_FALSE + 1];
+	size_t error_index;
+	Error error;
+	source_buffer* source;
+
+	size_t size() const;
+	uint32_t intern(string_view text);
+	void push(const Token& t, size_t end_offset);
+	Token get(size_t i) const;
+	Token get(size_t i, size_t& line_hint) const;
+};
+
+Error lex_init(lexer& lex, const char* src_code);
+
+Error lex_init_text(lexer& lex, const char* text, size_t len);
+
+Error lex_all(lexer& lex, token_stream& ts);
+
+Error lex_parallel(lexer& lex, token_stream& ts, unsigned threads);
+
+Error get_token(lexer& lex, Token& t);
+
+// As get_token, but warnings are added to notes instead of going to cerr.
+Error get_token(lexer& lex, Token& t, vector<diagnostic>& notes);
+
+bool lex_eof(lexer& lex);
+
+void lex_cleanup(lexer& lex);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,216 @@
+#include "lex_scan.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LEX_SCAN_AVX2
+#endif
+
+static inline bool is_space(unsigned char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static inline bool is_digit(unsigned char c)
+{
+	return (unsigned)(c - '0') < 10;
+}
+
+static inline bool is_ident(unsigned char c)
+{
+	return is_digit(c) || (unsigned)((c | 0x20) - 'a') < 26 || c == '_';
+}
+
+static const char* scan_space_scalar(const char* p)
+{
+	while (is_space(*p))
+	{
+		p++;
+	}
+	return p;
+}
+
+static const char* scan_comment_scalar(const char* p)
+{
+	while (*p != '\n' && *p != '\0')
+	{
+		p++;
+	}
+	return p;
+}
+
+static const char* scan_ident_scalar(const char* p)
+{
+	while (is_ident(*p))
+	{
+		p++;
+	}
+	return p;
+}
+
+static const char* scan_digits_scalar(const char* p)
+{
+	while (is_digit(*p))
+	{
+		p++;
+	}
+	return p;
+}
+
+// The vector scanners use aligned loads only. An aligned block that holds
+// at least one byte up to the sentinel never crosses a page boundary, so
+// reading the whole block is safe even at the very end of the mapping.
+// The bytes it holds before p or past the sentinel are outside the object,
+// though, which AddressSanitizer would report for a heap buffer; those
+// bytes are masked off or never looked at, so the scanners opt out.
+#if defined(__GNUC__)
+#define SCAN_NO_ASAN __attribute__((no_sanitize_address))
+#else
+#define SCAN_NO_ASAN
+#endif
+
+#ifdef __SSE2__
+static inline __m128i in_range_sse2(__m128i v, char lo, char hi)
+{
+	return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+struct space_sse2
+{
+	static inline unsigned stop(__m128i v)
+	{
+		__m128i ws = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+		return ~(unsigned)_mm_movemask_epi8(ws) & 0xFFFF;
+	}
+};
+
+struct comment_sse2
+{
+	static inline unsigned stop(__m128i v)
+	{
+		__m128i end = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+		return (unsigned)_mm_movemask_epi8(end);
+	}
+};
+
+struct ident_sse2
+{
+	static inline unsigned stop(__m128i v)
+	{
+		__m128i letter = in_range_sse2(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+		__m128i ident = _mm_or_si128(_mm_or_si128(letter, in_range_sse2(v, '0', '9')), _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+		return ~(unsigned)_mm_movemask_epi8(ident) & 0xFFFF;
+	}
+};
+
+struct digits_sse2
+{
+	static inline unsigned stop(__m128i v)
+	{
+		return ~(unsigned)_mm_movemask_epi8(in_range_sse2(v, '0', '9')) & 0xFFFF;
+	}
+};
+
+template <typename K>
+SCAN_NO_ASAN static const char* scan_sse2(const char* p)
+{
+	uintptr_t misalign = (uintptr_t)p & 15;
+	const char* block = p - misalign;
+	unsigned mask = K::stop(_mm_load_si128(reinterpret_cast<const __m128i*>(block))) & (0xFFFFu << misalign);
+	while (mask == 0)
+	{
+		block += 16;
+		mask = K::stop(_mm_load_si128(reinterpret_cast<const __m128i*>(block)));
+	}
+	return block + __builtin_ctz(mask);
+}
+#endif
+
+#ifdef LEX_SCAN_AVX2
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET static inline __m256i in_range_avx2(__m256i v, char lo, char hi)
+{
+	return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+}
+
+struct space_avx2
+{
+	AVX2_TARGET static inline uint32_t stop(__m256i v)
+	{
+		__m256i ws = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
+		return ~(uint32_t)_mm256_movemask_epi8(ws);
+	}
+};
+
+struct comment_avx2
+{
+	AVX2_TARGET static inline uint32_t stop(__m256i v)
+	{
+		__m256i end = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+		return (uint32_t)_mm256_movemask_epi8(end);
+	}
+};
+
+struct ident_avx2
+{
+	AVX2_TARGET static inline uint32_t stop(__m256i v)
+	{
+		__m256i letter = in_range_avx2(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+		__m256i ident = _mm256_or_si256(_mm256_or_si256(letter, in_range_avx2(v, '0', '9')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+		return ~(uint32_t)_mm256_movemask_epi8(ident);
+	}
+};
+
+struct digits_avx2
+{
+	AVX2_TARGET static inline uint32_t stop(__m256i v)
+	{
+		return ~(uint32_t)_mm256_movemask_epi8(in_range_avx2(v, '0', '9'));
+	}
+};
+
+template <typename K>
+AVX2_TARGET SCAN_NO_ASAN static const char* scan_avx2(const char* p)
+{
+	uintptr_t misalign = (uintptr_t)p & 31;
+	const char* block = p - misalign;
+	uint32_t mask = K::stop(_mm256_load_si256(reinterpret_cast<const __m256i*>(block))) & (0xFFFFFFFFu << misalign);
+	while (mask == 0)
+	{
+		block += 32;
+		mask = K::stop(_mm256_load_si256(reinterpret_cast<const __m256i*>(block)));
+	}
+	return block + __builtin_ctz(mask);
+}
+#endif
+
+static scan_kernels select_scan_kernels(void)
+{
+	const scan_kernels scalar = { "scalar", scan_space_scalar, scan_comment_scalar, scan_ident_scalar, scan_digits_scalar };
+	const char* forced = getenv("NCC_SCAN");
+
+#ifdef LEX_SCAN_AVX2
+	if ((forced == nullptr || strcmp(forced, "avx2") == 0) && __builtin_cpu_supports("avx2"))
+	{
+		return { "avx2", scan_avx2<space_avx2>, scan_avx2<comment_avx2>, scan_avx2<ident_avx2>, scan_avx2<digits_avx2> };
+	}
+#endif
+#ifdef __SSE2__
+	if (forced == nullptr || strcmp(forced, "scalar") != 0)
+	{
+		return { "sse2", scan_sse2<space_sse2>, scan_sse2<comment_sse2>, scan_sse2<ident_sse2>, scan_sse2<digits_sse2> };
+	}
+#endif
+	return scalar;
+}
+
+const scan_kernels lex_scan = select_scan_kernels();
@@ -0,0 +1,20 @@
+#ifndef LEX_SCAN_H
+#define LEX_SCAN_H
+
+// Run scanners used by get_token. Each returns the first character at or
+// after p that does not belong to the run. The source must end with a '\0'
+// sentinel, which ends every run.
+typedef const char* (*scan_fn)(const char* p);
+
+struct scan_kernels
+{
+	const char* name;
+	scan_fn space;
+	scan_fn comment;
+	scan_fn ident;
+	scan_fn digits;
+};
+
+extern const scan_kernels lex_scan;
+
+#endif
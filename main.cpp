@@ -3,49 +3,504 @@
 #include "token.h"
 #include "lex.h"
 #include "c_tree.h"
+#include "context.h"
+#include "c_ast.h"
+#include "c_cache.h"
+#include "c_opt.h"
+#include "c_vm.h"
+#include "c_closure.h"
 #include <fstream>
 #include <iostream>
 #include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
 
 using namespace std;
 
+static int bench_lex(const char* filename, bool up_front, unsigned threads)
+{
+    const int rounds = 5;
+    double best = 0;
+    size_t tokens = 0;
+    size_t bytes = 0;
+
+    for (int round = 0; round < rounds; round++)
+    {
+        auto start = chrono::steady_clock::now();
+        lexer lex;
+        if (lex_init(lex, filename).error != NCC_OK)
+        {
+            cerr << "Error initializing lexer for file: " << filename << endl;
+            return 1;
+        }
+        if (up_front)
+        {
+            token_stream ts;
+            lex_parallel(lex, ts, threads);
+            tokens = ts.size();
+            bytes = ts.size() > 0 ? ts.offset.back() : 0;
+        }
+        else
+        {
+            Token t;
+            tokens = 0;
+            do
+            {
+                get_token(lex, t);
+                tokens++;
+            } while (t.id != TOKEN_EOF);
+            bytes = t.offset;
+        }
+        lex_cleanup(lex);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (round == 0 || seconds < best)
+        {
+            best = seconds;
+        }
+    }
+
+    cout << "lexed " << tokens << " tokens (" << bytes << " bytes) in " << best * 1000 << " ms: "
+        << (size_t)(tokens / best) << " tokens/s, " << bytes / best / 1e6 << " MB/s" << endl;
+    return 0;
+}
+
+// Times parsing alone: the file is lexed up front each round and only the
+// statement loop (or parse_parallel) is measured.
+static int bench_parse(const char* filename, unsigned threads)
+{
+    const int rounds = 5;
+    double best = 0;
+    size_t tokens = 0;
+    size_t statements = 0;
+    size_t nodes = 0;
+
+    for (int round = 0; round < rounds; round++)
+    {
+        compilation_context ctx;
+        if (lex_init(ctx.lex, filename).error != NCC_OK)
+        {
+            cerr << "Error initializing lexer for file: " << filename << endl;
+            return 1;
+        }
+        token_stream ts;
+        lex_all(ctx.lex, ts);
+        tokens = ts.size();
+
+        auto start = chrono::steady_clock::now();
+        vector<unique_ptr<parse>> parsers;
+        vector<node*> program_statements;
+        if (!parse_parallel(ctx, ts, threads, parsers, program_statements))
+        {
+            parsers.push_back(make_unique<parse>(ctx, ts));
+            parse& parser = *parsers.back();
+            node* statement_root;
+            while (parser.get_current_token().id != TOKEN_EOF && (statement_root = parser.parse_statement()) != nullptr)
+            {
+                program_statements.push_back(statement_root);
+            }
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        statements = program_statements.size();
+        nodes = 0;
+        for (const unique_ptr<parse>& parser : parsers)
+        {
+            nodes += parser->get_arena().node_count();
+        }
+        lex_cleanup(ctx.lex);
+        if (round == 0 || seconds < best)
+        {
+            best = seconds;
+        }
+    }
+
+    cout << "parsed " << statements << " statements (" << tokens << " tokens, " << nodes << " nodes) in "
+        << best * 1000 << " ms: " << (size_t)(tokens / best) << " tokens/s" << endl;
+    return 0;
+}
+
+enum execution_engine
+{
+    engine_walk,
+    engine_closure,
+    engine_vm
+};
+
+// Times execution alone, for a program that does not read: it is parsed
+// and optimized once, then each engine runs it from fresh variables with
+// its output discarded. The walker runs both with its runtime checks and
+// after verify_program.
+static int bench_run(const char* filename, bool fold)
+{
+    const int rounds = 5;
+    compilation_context ctx;
+    if (lex_init(ctx.lex, filename).error != NCC_OK)
+    {
+        cerr << "Error initializing lexer for file: " << filename << endl;
+        return 1;
+    }
+    parse parser(ctx);
+    vector<node*> program_statements;
+    node* statement_root;
+    while (parser.get_current_token().id != TOKEN_EOF && (statement_root = parser.parse_statement()) != nullptr)
+    {
+        program_statements.push_back(statement_root);
+    }
+    if (!ctx.diagnostics.empty())
+    {
+        report_diagnostics(ctx);
+        return 1;
+    }
+    if (fold)
+    {
+        optimize(ctx, program_statements);
+    }
+    compact_ast ast;
+    ast.build(program_statements);
+    closure_program closures;
+    closures.build(ctx, program_statements);
+    vm_program program;
+    vm_compile(ctx, program_statements, program);
+
+    struct discard_buffer : streambuf
+    {
+        int overflow(int c) override { return c; }
+        streamsize xsputn(const char*, streamsize n) override { return n; }
+    } discard;
+    streambuf* output = cout.rdbuf(&discard);
+    auto best_of = [&](auto run)
+    {
+        double best = 0;
+        for (int round = 0; round < rounds; round++)
+        {
+            ctx.variable_values.assign(ctx.sym_table.size(), 0);
+            auto start = chrono::steady_clock::now();
+            run();
+            output_flush(ctx.output);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            if (round == 0 || seconds < best)
+            {
+                best = seconds;
+            }
+        }
+        return best;
+    };
+    auto walk_tree = [&]
+    {
+        for (node* statement : program_statements)
+        {
+            statement->evaluate(ctx);
+        }
+    };
+    double checked = best_of(walk_tree);
+    verify_program(ctx, program_statements);
+    double walk = best_of(walk_tree);
+    double compact = best_of([&]
+    {
+        for (uint32_t statement : ast.statements)
+        {
+            ast.evaluate(ctx, statement);
+        }
+    });
+    double threaded = best_of([&]
+    {
+        for (const closure* statement : closures.statements)
+        {
+            closures.evaluate(ctx, statement);
+        }
+    });
+    double vm = best_of([&] { vm_run(ctx, program); });
+    cout.rdbuf(output);
+
+    cout << "checked walk " << checked * 1000 << " ms, walk " << walk * 1000 << " ms, compact walk " << compact * 1000 << " ms, closures " << threaded * 1000
+        << " ms (" << walk / threaded << "x), vm " << vm * 1000 << " ms (" << walk / vm << "x)" << endl;
+    lex_cleanup(ctx.lex);
+    return 0;
+}
+
+// Times the input path of read alone: every integer on standard input is
+// parsed once, in order, as a program's reads would consume them.
+static int bench_read()
+{
+    input_source in;
+    size_t count = 0;
+    long long sum = 0;
+    int value;
+    auto start = chrono::steady_clock::now();
+    while (input_int(in, value))
+    {
+        count++;
+        sum += value;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    input_cleanup(in);
+
+    cout << "read " << count << " integers (sum " << sum << ") in " << seconds * 1000 << " ms: "
+        << (size_t)(count / seconds) << " integers/s" << endl;
+    return 0;
+}
+
 int main(int argc, char* argv[])
 {
-    const char* filename = argv[1];
-    Error e = lex_init(filename);
+    const char* filename = nullptr;
+    bool lex_only = false;
+    bool parse_only = false;
+    bool run_only = false;
+    bool read_only = false;
+    bool up_front = false;
+    unsigned threads = 1;
+    unsigned parse_threads = 1;
+    bool ast_stats = false;
+    bool compact = false;
+    size_t max_errors = 20;
+    const char* cache_path = nullptr;
+    bool fold = true;
+    bool runtime_checks = false;
+    int output_fd = -1;
+    execution_engine engine = engine_walk;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--bench-lex") == 0)
+        {
+            lex_only = true;
+        }
+        else if (strcmp(argv[i], "--bench-parse") == 0)
+        {
+            parse_only = true;
+        }
+        else if (strcmp(argv[i], "--bench-run") == 0)
+        {
+            run_only = true;
+        }
+        else if (strcmp(argv[i], "--bench-read") == 0)
+        {
+            read_only = true;
+        }
+        else if (strcmp(argv[i], "--pretokenize") == 0)
+        {
+            up_front = true;
+        }
+        else if (strcmp(argv[i], "--compact-ast") == 0)
+        {
+            compact = true;
+        }
+        else if (strcmp(argv[i], "--ast-stats") == 0)
+        {
+            ast_stats = true;
+        }
+        else if (strcmp(argv[i], "--no-optimize") == 0)
+        {
+            fold = false;
+        }
+        else if (strcmp(argv[i], "--runtime-checks") == 0)
+        {
+            runtime_checks = true;
+        }
+        else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "walk") == 0)
+            {
+                engine = engine_walk;
+            }
+            else if (strcmp(argv[i], "closure") == 0)
+            {
+                engine = engine_closure;
+            }
+            else if (strcmp(argv[i], "vm") == 0)
+            {
+                engine = engine_vm;
+            }
+            else
+            {
+                cerr << "Unknown engine: " << argv[i] << endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--ast-cache") == 0 && i + 1 < argc)
+        {
+            cache_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--output-fd") == 0 && i + 1 < argc)
+        {
+            output_fd = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-errors") == 0 && i + 1 < argc)
+        {
+            max_errors = (size_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--lex-threads") == 0 && i + 1 < argc)
+        {
+            threads = (unsigned)atoi(argv[++i]);
+            if (threads == 0)
+            {
+                threads = max(1u, thread::hardware_concurrency());
+            }
+            up_front = true;
+        }
+        else if (strcmp(argv[i], "--parse-threads") == 0 && i + 1 < argc)
+        {
+            parse_threads = (unsigned)atoi(argv[++i]);
+            if (parse_threads == 0)
+            {
+                parse_threads = max(1u, thread::hardware_concurrency());
+            }
+            up_front = true;
+        }
+        else
+        {
+            filename = argv[i];
+        }
+    }
+    if (read_only)
+    {
+        return bench_read();
+    }
+    if (filename == nullptr)
+    {
+        cerr << "Usage: " << argv[0] << " [--bench-lex] [--bench-parse] [--bench-run] [--bench-read] [--pretokenize] [--lex-threads N] [--parse-threads N] [--compact-ast] [--ast-cache FILE] [--no-optimize] [--engine walk|closure|vm] [--runtime-checks] [--output-fd N] [--ast-stats] [--max-errors N] <source file | ->" << endl;
+        return 1;
+    }
+    if (lex_only)
+    {
+        return bench_lex(filename, up_front, threads);
+    }
+    if (parse_only)
+    {
+        return bench_parse(filename, parse_threads);
+    }
+    if (run_only)
+    {
+        return bench_run(filename, fold);
+    }
+
+    compilation_context ctx;
+    ctx.max_errors = max_errors;
+    output_init(ctx.output, output_fd);
+    Error e = lex_init(ctx.lex, filename);
     if (e.error != NCC_OK)
     {
         cerr << "Error initializing lexer for file: " << filename << endl;
         return 1;
     }
 
-    parse parser;
+    compact_ast ast;
+    ast_cache cache;
+    bool cached = false;
+    uint64_t source_hash = 0;
+    if (cache_path != nullptr && !buffer_streaming(ctx.lex.source))
+    {
+        source_hash = ast_source_hash(buffer_at(ctx.lex.source, 0), buffer_end(ctx.lex.source));
+        cached = ast_cache_load(cache, cache_path, source_hash, buffer_end(ctx.lex.source), ctx, ast);
+        compact = true;
+    }
+    else
+    {
+        cache_path = nullptr;
+    }
+
+    token_stream tokens;
+    vector<unique_ptr<parse>> parsers;
     vector<node*> program_statements;
 
-    while (parser.get_current_token().id != TOKEN_EOF)
+    if (!cached)
     {
-        node* statement_root = parser.parse_statement();
-
-        if (statement_root != nullptr)
+        if (up_front && !buffer_streaming(ctx.lex.source) && buffer_end(ctx.lex.source) <= UINT32_MAX)
         {
-            program_statements.push_back(statement_root);
+            lex_parallel(ctx.lex, tokens, threads);
         }
         else
         {
-            if (parser.get_current_token().id != TOKEN_EOF)
+            up_front = false;
+        }
+
+        if (!up_front || !parse_parallel(ctx, tokens, parse_threads, parsers, program_statements))
+        {
+            parsers.push_back(up_front ? make_unique<parse>(ctx, tokens) : make_unique<parse>(ctx));
+            parse& parser = *parsers.back();
+
+            while (parser.get_current_token().id != TOKEN_EOF)
             {
-                parser.error("Expected a valid statement or EOF", parser.get_current_token().line, parser.get_current_token().col);
-                break;
+                node* statement_root = parser.parse_statement();
+
+                if (statement_root != nullptr)
+                {
+                    program_statements.push_back(statement_root);
+                }
+                else
+                {
+                    if (parser.get_current_token().id != TOKEN_EOF)
+                    {
+                        parser.report("Expected a valid statement or EOF", parser.get_current_token().line, parser.get_current_token().col);
+                    }
+                }
+            }
+        }
+        if (!ctx.diagnostics.empty())
+        {
+            report_diagnostics(ctx);
+            return 1;
+        }
+
+        if (compact)
+        {
+            ast.build(program_statements);
+            if (cache_path != nullptr)
+            {
+                ast_cache_save(cache_path, source_hash, buffer_end(ctx.lex.source), ctx, ast);
             }
         }
     }
 
-    if (!sym_table.empty())
+    if (!ctx.sym_table.empty())
     {
-        variable_values.resize(sym_table.size(), 0);
+        ctx.variable_values.resize(ctx.sym_table.size(), 0);
     }
 
-    if (!program_statements.empty())
+    if (compact && !ast.statements.empty())
+    {
+        cout << "Code Tree:" << endl;
+        cout << "statement block" << endl;
+
+        for (uint32_t statement_root : ast.statements)
+        {
+            print_tree(ast, statement_root, 2);
+        }
+        if (fold)
+        {
+            optimize(ast);
+        }
+        if (!runtime_checks)
+        {
+            verify_program(ctx, ast);
+        }
+        cout << "Code execution:" << endl;
+        if (engine == engine_vm)
+        {
+            vm_program program;
+            vm_compile(ctx, ast, program);
+            vm_run(ctx, program);
+        }
+        else if (engine == engine_closure)
+        {
+            closure_program closures;
+            closures.build(ctx, ast);
+            for (const closure* statement : closures.statements)
+            {
+                closures.evaluate(ctx, statement);
+            }
+        }
+        else
+        {
+            for (uint32_t statement : ast.statements)
+            {
+                ast.evaluate(ctx, statement);
+            }
+        }
+    }
+    else if (!program_statements.empty())
     {
         cout << "Code Tree:" << endl;
         cout << "statement block" << endl;
@@ -54,21 +509,64 @@ int main(int argc, char* argv[])
         {
             print_tree(statement_root, 2);
         }
+        if (fold)
+        {
+            optimize(ctx, program_statements);
+        }
+        if (!runtime_checks)
+        {
+            verify_program(ctx, program_statements);
+        }
         cout << "Code execution:" << endl;
-        for (node* statement : program_statements)
+        if (engine == engine_vm)
+        {
+            vm_program program;
+            vm_compile(ctx, program_statements, program);
+            vm_run(ctx, program);
+        }
+        else if (engine == engine_closure)
+        {
+            closure_program closures;
+            closures.build(ctx, program_statements);
+            for (const closure* statement : closures.statements)
+            {
+                closures.evaluate(ctx, statement);
+            }
+        }
+        else
         {
-            statement->evaluate();
+            for (node* statement : program_statements)
+            {
+                statement->evaluate(ctx);
+            }
         }
     }
     else {
         cout << "No valid statements found in the input." << endl;
     }
-    for (node* statement_root : program_statements)
+    output_flush(ctx.output);
+    if (ast_stats)
     {
-        delete statement_root;
+        size_t node_count = 0;
+        size_t bytes_used = 0;
+        size_t bytes_reserved = 0;
+        for (const unique_ptr<parse>& parser : parsers)
+        {
+            node_count += parser->get_arena().node_count();
+            bytes_used += parser->get_arena().bytes_used();
+            bytes_reserved += parser->get_arena().bytes_reserved();
+        }
+        cerr << "AST: " << node_count << " nodes, " << bytes_used << " bytes used, "
+            << bytes_reserved << " bytes reserved" << endl;
+        if (compact)
+        {
+            cerr << "compact AST: " << ast.node_count << " nodes, " << ast.bytes() << " bytes" << endl;
+        }
     }
     program_statements.clear();
 
-    lex_cleanup();
+    ast_cache_close(cache);
+    input_cleanup(ctx.input);
+    lex_cleanup(ctx.lex);
     return 0;
 }
\ No newline at end of file
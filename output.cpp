@@ -0,0 +1,106 @@
+#include "output.h"
+#include <iostream>
+#ifndef _WIN32
+#include <cerrno>
+#include <sys/uio.h>
+#endif
+using namespace std;
+
+void output_init(output_sink& out, int fd)
+{
+	out.fd = fd;
+	out.buffer.resize(output_buffer_size);
+	out.pos = out.segment_start = out.buffer.data();
+	out.end = out.buffer.data() + out.buffer.size();
+	out.segments.clear();
+}
+
+static void output_close_segment(output_sink& out)
+{
+	if (out.pos != out.segment_start)
+	{
+		out.segments.push_back({ out.segment_start, (size_t)(out.pos - out.segment_start) });
+		out.segment_start = out.pos;
+	}
+}
+
+#ifndef _WIN32
+// Writes all segments with as few writev calls as the kernel allows. Output
+// that cannot be written is dropped, as it would be by a failed stream.
+static void output_writev(output_sink& out)
+{
+	iovec iov[output_max_segments];
+	size_t count = out.segments.size();
+	for (size_t i = 0; i < count; i++)
+	{
+		iov[i].iov_base = (void*)out.segments[i].data;
+		iov[i].iov_len = out.segments[i].len;
+	}
+
+	// What cout already holds goes first.
+	cout.flush();
+
+	iovec* first = iov;
+	while (count > 0)
+	{
+		ssize_t written = writev(out.fd, first, (int)count);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return;
+		}
+		while (count > 0 && (size_t)written >= first->iov_len)
+		{
+			written -= first->iov_len;
+			first++;
+			count--;
+		}
+		if (count > 0)
+		{
+			first->iov_base = (char*)first->iov_base + written;
+			first->iov_len -= written;
+		}
+	}
+}
+#endif
+
+void output_flush(output_sink& out)
+{
+	output_close_segment(out);
+	if (!out.segments.empty())
+	{
+#ifndef _WIN32
+		if (out.fd >= 0)
+		{
+			output_writev(out);
+		}
+		else
+#endif
+		{
+			for (const output_segment& segment : out.segments)
+			{
+				cout.write(segment.data, segment.len);
+			}
+		}
+		out.segments.clear();
+	}
+	if (out.buffer.empty())
+	{
+		output_init(out, out.fd);
+	}
+	out.pos = out.segment_start = out.buffer.data();
+}
+
+// Queues s without copying it.
+void output_reference(output_sink& out, string_view s)
+{
+	output_close_segment(out);
+	out.segments.push_back({ s.data(), s.size() });
+	if (out.segments.size() >= output_max_segments - 1)
+	{
+		output_flush(out);
+	}
+}
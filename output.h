@@ -0,0 +1,71 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <charconv>
+#include <cstring>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+// What print writes goes here instead of straight to cout. Bytes collect in
+// buffer and leave in one go when it fills, before a read, before a runtime
+// error and at the end of the run. A string of at least output_reference_size
+// bytes is not copied: it is queued by reference as its own segment, so it
+// must stay put until the next flush. With fd set, flushing is one writev of
+// all segments to fd; otherwise the segments go to cout's stream buffer.
+struct output_segment
+{
+	const char* data;
+	size_t len;
+};
+
+struct output_sink
+{
+	vector<char> buffer;
+	char* pos = nullptr;
+	char* end = nullptr;
+	char* segment_start = nullptr;
+	vector<output_segment> segments;
+	int fd = -1;
+};
+
+static const size_t output_buffer_size = 256 * 1024;
+static const size_t output_reference_size = 512;
+static const size_t output_max_segments = 64;
+
+void output_init(output_sink& out, int fd);
+
+void output_flush(output_sink& out);
+
+void output_reference(output_sink& out, string_view s);
+
+inline void output_write(output_sink& out, string_view s)
+{
+	if (s.size() >= (size_t)(out.end - out.pos))
+	{
+		if (s.size() >= output_reference_size)
+		{
+			output_reference(out, s);
+			return;
+		}
+		output_flush(out);
+	}
+	memcpy(out.pos, s.data(), s.size());
+	out.pos += s.size();
+}
+
+inline void output_int(output_sink& out, int value)
+{
+	if (out.end - out.pos < 11)
+	{
+		output_flush(out);
+	}
+	out.pos = to_chars(out.pos, out.end, value).ptr;
+}
+
+inline void output_bool(output_sink& out, bool value)
+{
+	output_write(out, value ? string_view("true", 4) : string_view("false", 5));
+}
+
+#endif
@@ -1,9 +1,6 @@
 #include "s_table.h"
 
-vector<symbol_data> sym_table;
-vector<string> string_table;
-
-int add_string_constant(const std::string& val)
+int add_string_constant(vector<string>& string_table, const std::string& val)
 {
 	for (int i = 0; i < (int)string_table.size(); i++)
 	{
@@ -16,10 +13,10 @@ int add_string_constant(const std::string& val)
 	return (int)string_table.size() - 1;
 }
 
-int insert(const string& name, symbol_type stype, value_type vtype)
+int insert(vector<symbol_data>& sym_table, string_view name, symbol_type stype, value_type vtype)
 {
 	symbol_data new_sym;
-	new_sym.name = name;
+	new_sym.name = string(name);
 	new_sym.sym_type = stype;
 	new_sym.loc_type = loc_stack;
 	new_sym.val_type = vtype;
@@ -29,7 +26,7 @@ int insert(const string& name, symbol_type stype, value_type vtype)
 	return sym_table.size() - 1;
 }
 
-int find(const string& name)
+int find(const vector<symbol_data>& sym_table, string_view name)
 {
 	for (size_t i = 0; i < sym_table.size(); ++i)
 	{
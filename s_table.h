@@ -3,10 +3,11 @@
 
 #include <iostream>
 #include <vector>
+#include <string>
+#include <string_view>
 using namespace std;
 
-extern vector<string> string_table;
-int add_string_constant(const std::string& val);
+int add_string_constant(vector<string>& string_table, const std::string& val);
 
 enum symbol_type
 {
@@ -38,9 +39,7 @@ struct symbol_data
 	int offset;
 };
 
-extern vector<symbol_data> sym_table;
-
-int insert(const string& name, symbol_type stype, value_type vtype);
-int find(const string& name);
+int insert(vector<symbol_data>& sym_table, string_view name, symbol_type stype, value_type vtype);
+int find(const vector<symbol_data>& sym_table, string_view name);
 
 #endif
\ No newline at end of file
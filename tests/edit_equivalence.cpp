@@ -0,0 +1,113 @@
+// Applies random edits to a document and checks after each one that it
+// matches a document built from scratch from the same text: statements,
+// trees with positions and literal values, diagnostics and sym_table.
+// A document must report only through its diagnostics, never on cerr.
+//
+// Build from this directory with every translation unit but main.cpp:
+//   g++ -std=c++17 -I.. -o edit_equivalence edit_equivalence.cpp $(ls ../*.cpp | grep -v main.cpp) -lpthread
+// Run:
+//   ./edit_equivalence <seed> <edits>
+
+#include "c_edit.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+using namespace std;
+
+static void dump(ostream& o, const compilation_context& ctx, const node* n)
+{
+	if (n == nullptr)
+	{
+		o << "-";
+		return;
+	}
+	o << "(" << n->token.id << " '" << n->token.val << "' " << n->token.line << ":" << n->token.col << "@" << n->token.offset
+		<< " t" << n->val_type << " s" << n->symbol_table_index << " v" << n->value << " ";
+	if (n->token.id == TOKEN_STRING)
+	{
+		o << "\"" << ctx.string_table.at(n->value) << "\" ";
+	}
+	dump(o, ctx, n->left);
+	o << " ";
+	dump(o, ctx, n->right);
+	o << " ";
+	dump(o, ctx, n->next);
+	o << ")";
+}
+
+static string state(document& doc)
+{
+	ostringstream o;
+	for (const document_statement& s : doc.statements())
+	{
+		o << "S " << s.first << " " << s.count << " " << s.sym_begin << " ";
+		dump(o, doc.context(), s.root);
+		o << "\n";
+		for (const diagnostic& d : s.diagnostics)
+		{
+			o << "  D " << d.message << " " << d.line << ":" << d.col << "\n";
+		}
+	}
+	o << "T " << doc.context().string_table.size() << "\n";
+	for (const symbol_data& symbol : doc.context().sym_table)
+	{
+		o << "Y " << symbol.name << " " << symbol.offset << "\n";
+	}
+	return o.str();
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		fprintf(stderr, "Usage: %s <seed> <edits>\n", argv[0]);
+		return 2;
+	}
+	mt19937 rng((unsigned)atoi(argv[1]));
+	int edits = atoi(argv[2]);
+	const char* snippets[] = { "int4 a;", "int4 b;", "int4 c;", " a <- a + 1;", "b <- 2*(a-1);", "\n",
+		"if (a < b) { a <- 1; } else { b <- 2; }", "while (a < 3) { a <- a + 1; }", "print(a, \"x\\n\");", "read(b);",
+		"{ int4 d; d <- 1; }", " ", "}", "{", "(", ")", ";", "$", "else", "#c\n", "\"s", "1 -- 2", "a", "<-", "+", "x",
+		";;", "!true", "\"", "print(\"a\", \"b\");", "\"t\"", "false", "read(" };
+	const size_t statement_snippets = 11;
+	const size_t snippet_count = sizeof(snippets) / sizeof(*snippets);
+
+	string text;
+	for (int i = 0; i < 20; i++)
+	{
+		text += snippets[rng() % statement_snippets];
+	}
+	ostringstream errors;
+	streambuf* cerr_buffer = cerr.rdbuf(errors.rdbuf());
+	document doc(text);
+
+	size_t full = 0;
+	size_t parsed = 0;
+	for (int e = 0; e < edits; e++)
+	{
+		size_t offset = rng() % (doc.text().size() + 1);
+		size_t removed = rng() % 3 == 0 ? rng() % 8 : 0;
+		string inserted = rng() % 4 == 0 ? "" : snippets[rng() % snippet_count];
+		document::edit_result result = doc.edit(offset, removed, inserted);
+		full += result.full_reparse;
+		parsed += result.statements_parsed;
+
+		document fresh(doc.text());
+		string incremental_state = state(doc);
+		string fresh_state = state(fresh);
+		if (incremental_state != fresh_state || !errors.str().empty())
+		{
+			cerr.rdbuf(cerr_buffer);
+			printf("MISMATCH seed %s edit %d: edit(%zu, %zu, \"%s\")\n--- text\n%s\n--- incremental\n%s\n--- fresh\n%s\n--- cerr\n%s\n",
+				argv[1], e, offset, removed, inserted.c_str(), doc.text().c_str(), incremental_state.c_str(), fresh_state.c_str(), errors.str().c_str());
+			return 1;
+		}
+	}
+	cerr.rdbuf(cerr_buffer);
+	printf("ok: %d edits, %zu full reparses, %zu statements parsed\n", edits, full, parsed);
+	return 0;
+}
@@ -2,6 +2,7 @@
 #define TOKEN_H
 
 #include <string>
+#include <string_view>
 using namespace std;
 
 enum token_id
@@ -55,7 +56,8 @@ struct Token
 {
     token_id id;
 	int line, col;
-	string val;
+	size_t offset;
+	string_view val;
 };
 
 void print_token(const Token& t);